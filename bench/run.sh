@@ -0,0 +1,118 @@
+#!/bin/sh
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+# Runs sharks-bench on a throwaway display and prints its JSON report.
+#
+#   bench/run.sh <xvfb|sway|cage> [layout] [-- sharks-bench options]
+#
+# layout is a comma separated list of outputs, placed left to right, like 1920x1080,2560x1440.
+# cage only has a single output and ignores it. The binary is taken from $SHARKS_BENCH, or
+# build/sharks-bench (cmake --build build --target sharks-bench).
+
+set -eu
+
+display="${1:?usage: $0 <xvfb|sway|cage> [layout] [-- sharks-bench options]}"
+shift
+layout="1920x1080"
+if [ $# -gt 0 ] && [ "$1" != "--" ]; then
+	layout="$1"
+	shift
+fi
+if [ $# -gt 0 ] && [ "$1" = "--" ]; then
+	shift
+fi
+
+bench="$(realpath "${SHARKS_BENCH:-build/sharks-bench}")"
+tmp="$(mktemp -d)"
+trap 'kill $server 2>/dev/null || true; rm -rf "$tmp"' EXIT
+server=""
+
+# total width and tallest height of the layout
+width=0
+height=0
+for output in $(echo "$layout" | tr ',' ' '); do
+	w="${output%x*}"
+	h="${output#*x}"
+	width=$((width + w))
+	if [ "$h" -gt "$height" ]; then
+		height="$h"
+	fi
+done
+
+case "$display" in
+xvfb)
+	# Xvfb picks a free display and writes its number once it is ready for clients
+	Xvfb -displayfd 3 -screen 0 "${width}x${height}x24" -nolisten tcp 3>"$tmp/display" >"$tmp/server.log" 2>&1 &
+	server=$!
+	for _ in $(seq 50); do
+		[ -s "$tmp/display" ] && break
+		sleep 0.1
+	done
+	if [ ! -s "$tmp/display" ]; then
+		echo "Xvfb did not start, see its log:" >&2
+		cat "$tmp/server.log" >&2
+		exit 1
+	fi
+	export DISPLAY=":$(cat "$tmp/display")"
+
+	# Xvfb has a single screen, so split it into randr monitors for Qt to see separate outputs
+	x=0
+	i=0
+	for output in $(echo "$layout" | tr ',' ' '); do
+		w="${output%x*}"
+		h="${output#*x}"
+		xrandr --setmonitor "bench-$i" "$w/0x$h/0+$x+0" "$([ $i -eq 0 ] && echo screen || echo none)" >/dev/null
+		x=$((x + w))
+		i=$((i + 1))
+	done
+
+	QT_QPA_PLATFORM=xcb "$bench" "$@"
+	;;
+sway)
+	export XDG_RUNTIME_DIR="$tmp"
+	export WLR_BACKENDS=headless
+	export WLR_LIBINPUT_NO_DEVICES=1
+	export WLR_HEADLESS_OUTPUTS="$(echo "$layout" | tr ',' '\n' | wc -l)"
+
+	x=0
+	i=1
+	for output in $(echo "$layout" | tr ',' ' '); do
+		echo "output HEADLESS-$i mode --custom $output position $x 0" >>"$tmp/sway.conf"
+		x=$((x + ${output%x*}))
+		i=$((i + 1))
+	done
+
+	sway -c "$tmp/sway.conf" >"$tmp/server.log" 2>&1 &
+	server=$!
+	# the IPC socket comes up after the wayland one, so wait for both
+	socket=""
+	ipc=""
+	for _ in $(seq 50); do
+		socket="$(ls "$tmp" | grep -m1 '^wayland-[0-9]*$' || true)"
+		ipc="$(ls "$tmp" | grep -m1 '^sway-ipc\..*\.sock$' || true)"
+		[ -n "$socket" ] && [ -n "$ipc" ] && break
+		sleep 0.1
+	done
+	if [ -z "$socket" ] || [ -z "$ipc" ]; then
+		echo "sway did not start, see its log:" >&2
+		cat "$tmp/server.log" >&2
+		exit 1
+	fi
+	export WAYLAND_DISPLAY="$socket"
+	export SWAYSOCK="$tmp/$ipc"
+
+	QT_QPA_PLATFORM=wayland "$bench" "$@"
+	;;
+cage)
+	export XDG_RUNTIME_DIR="$tmp"
+	export WLR_BACKENDS=headless
+	export WLR_LIBINPUT_NO_DEVICES=1
+	QT_QPA_PLATFORM=wayland cage -- "$bench" "$@"
+	;;
+*)
+	echo "unknown display $display, expected xvfb, sway or cage" >&2
+	exit 2
+	;;
+esac
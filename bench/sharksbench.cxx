@@ -0,0 +1,191 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+// sharks-bench times the capture backends against whatever display it is started on and prints
+// the results as JSON. bench/run.sh starts it under Xvfb or a headless compositor with a given
+// output layout.
+#include <sys/resource.h>
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QScreen>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "platform.hxx"
+#include "wayland/waylandplatform.hxx"
+#include "x11/x11platform.hxx"
+
+struct BenchCase {
+	QString name;
+	QRect rect;
+};
+
+static long peakRssKiB() {
+	struct rusage usage {};
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// nearest rank percentile of sorted samples
+static double percentile(const std::vector<double> &sorted, double p) {
+	size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+	return sorted[qBound<size_t>(1, rank, sorted.size()) - 1];
+}
+
+static Platform *makePlatform(const QString &backend) {
+	if (backend == "auto") {
+		Platform::init();
+		return platform;
+	}
+#ifdef SHARKS_HAS_X
+	if (backend == "x11") {
+		return X11Platform::available() ? new X11Platform() : nullptr;
+	}
+#endif
+#ifdef SHARKS_HAS_WAYLAND
+	if (backend == "wayland") {
+		return WaylandPlatform::available() ? new WaylandPlatform() : nullptr;
+	}
+#endif
+	if (backend == "qt") {
+		return new Platform();
+	}
+	return nullptr;
+}
+
+static QJsonObject runCase(const BenchCase &c, int iterations, int warmup, bool pixmap, int incrementalTimeout) {
+	auto grab = [&]() {
+		QImage img;
+		if (incrementalTimeout >= 0) {
+			QRegion damage;
+			img = platform->getScreenshotIncremental(c.rect, &damage, incrementalTimeout);
+		} else {
+			img = platform->getScreenshotImage(c.rect);
+		}
+		if (pixmap) {
+			QPixmap::fromImage(img);
+		}
+		return img;
+	};
+
+	QSize size;
+	for (int i = 0; i < warmup; i++) {
+		size = grab().size();
+	}
+
+	std::vector<double> samples;
+	samples.reserve(iterations);
+	QElapsedTimer total;
+	total.start();
+	for (int i = 0; i < iterations; i++) {
+		QElapsedTimer t;
+		t.start();
+		QImage img = grab();
+		samples.push_back(t.nsecsElapsed() / 1e6);
+		size = img.size();
+	}
+	double seconds = total.nsecsElapsed() / 1e9;
+	std::sort(samples.begin(), samples.end());
+
+	double pixels = (double)size.width() * size.height() * iterations;
+	double mean = 0;
+	for (double s : samples) {
+		mean += s / samples.size();
+	}
+
+	return QJsonObject{
+		{"name", c.name},
+		{"rect", QJsonArray{c.rect.x(), c.rect.y(), c.rect.width(), c.rect.height()}},
+		{"image", QJsonArray{size.width(), size.height()}},
+		{"iterations", iterations},
+		{"min_ms", samples.front()},
+		{"p50_ms", percentile(samples, 50)},
+		{"p99_ms", percentile(samples, 99)},
+		{"max_ms", samples.back()},
+		{"mean_ms", mean},
+		{"megapixels_per_s", pixels / 1e6 / seconds},
+		{"mib_per_s", pixels * 4 / (1024 * 1024) / seconds},
+		{"peak_rss_kib", (qint64)peakRssKiB()},
+	};
+}
+
+int main(int argc, char *argv[]) {
+	QGuiApplication app(argc, argv);
+	QGuiApplication::setApplicationName("sharks-bench");
+
+	QCommandLineParser cli;
+	cli.addHelpOption();
+	QCommandLineOption backendOption("backend", "Capture backend: auto, x11, wayland or qt", "name", "auto");
+	QCommandLineOption iterationsOption("iterations", "Timed captures per case", "n", "100");
+	QCommandLineOption warmupOption("warmup", "Untimed captures before each case", "n", "5");
+	QCommandLineOption regionOption("region", "Also time this area, in virtual desktop coordinates", "x,y,w,h");
+	QCommandLineOption pixmapOption("pixmap", "Include the QPixmap upload, like Platform::getScreenshot");
+	QCommandLineOption incrementalOption("incremental", "Use getScreenshotIncremental, waiting at most ms for damage", "ms");
+	cli.addOptions({backendOption, iterationsOption, warmupOption, regionOption, pixmapOption, incrementalOption});
+	cli.process(app);
+
+	QString backend = cli.value(backendOption);
+	platform = makePlatform(backend);
+	if (platform == nullptr) {
+		qWarning() << "backend" << backend << "is not available";
+		return 1;
+	}
+
+	int iterations = qMax(1, cli.value(iterationsOption).toInt());
+	int warmup = qMax(0, cli.value(warmupOption).toInt());
+	int incrementalTimeout = cli.isSet(incrementalOption) ? qMax(0, cli.value(incrementalOption).toInt()) : -1;
+
+	QList<BenchCase> cases;
+	QJsonArray screens;
+	QRect desktop = QGuiApplication::primaryScreen()->virtualGeometry();
+	cases.append({"desktop", desktop});
+	for (QScreen *screen : QGuiApplication::screens()) {
+		QRect g = screen->geometry();
+		screens.append(QJsonObject{
+			{"name", screen->name()},
+			{"rect", QJsonArray{g.x(), g.y(), g.width(), g.height()}},
+			{"dpr", screen->devicePixelRatio()},
+		});
+		if (QGuiApplication::screens().size() > 1) {
+			cases.append({"screen:" + screen->name(), g});
+		}
+	}
+	// the size of a typical window or selection, across the middle of the desktop
+	QRect small(0, 0, 512, 512);
+	small.moveCenter(desktop.center());
+	cases.append({"region:512", small.intersected(desktop)});
+	if (cli.isSet(regionOption)) {
+		QRect region;
+		if (!parseRegion(cli.value(regionOption), &region)) {
+			qWarning() << "--region must be x,y,w,h with a positive size";
+			return 2;
+		}
+		cases.append({"region", region});
+	}
+
+	QJsonArray results;
+	for (const BenchCase &c : cases) {
+		results.append(runCase(c, iterations, warmup, cli.isSet(pixmapOption), incrementalTimeout));
+	}
+
+	QJsonObject report{
+		{"backend", QString(platform->metaObject()->className())},
+		{"qpa", QGuiApplication::platformName()},
+		{"qt", qVersion()},
+		{"desktop", QJsonArray{desktop.x(), desktop.y(), desktop.width(), desktop.height()}},
+		{"screens", screens},
+		{"mode", incrementalTimeout >= 0 ? "incremental" : "full"},
+		{"results", results},
+		{"peak_rss_kib", (qint64)peakRssKiB()},
+	};
+	fputs(QJsonDocument(report).toJson().constData(), stdout);
+	return 0;
+}
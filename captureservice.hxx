@@ -0,0 +1,80 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef CAPTURESERVICE_HXX
+#define CAPTURESERVICE_HXX
+
+#include <QByteArray>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#ifdef Q_OS_LINUX
+#define HAS_CAPTURESERVICE
+#endif
+
+#ifdef HAS_CAPTURESERVICE
+// Lets other programs take screenshots through the running instance, over the unix socket
+// $XDG_RUNTIME_DIR/sharks.sock. Each request is one line of space separated words:
+//
+//   capture [region=x,y,w,h | output=NAME] [cursor=0|1] [format=raw|ENCODER] [level=N]
+//
+// region is in virtual desktop coordinates and defaults to the whole desktop. format is raw (the
+// default) or one of the [save] formats. Each request gets one line back, and maybe a payload:
+//
+//   ok raw WIDTH HEIGHT STRIDE argb32   a sealed memfd with the pixels comes with this line as
+//                                       SCM_RIGHTS. Pixels are native endian, premultiplied
+//                                       0xAARRGGBB, STRIDE bytes per row
+//   ok FORMAT LENGTH                    followed by LENGTH bytes of the encoded image
+//   error MESSAGE
+//
+// A connection can make any number of requests. Each is answered before the next is read.
+class CaptureService : public QObject {
+	Q_DISABLE_COPY(CaptureService)
+
+	int fd;
+	QByteArray path;
+	QSocketNotifier *notifier;
+
+	CaptureService(int fd, QByteArray path, QObject *parent);
+	void accept();
+
+ public:
+	// starts listening, replacing any socket left behind by an earlier instance
+	static CaptureService *create(QObject *parent);
+	~CaptureService();
+};
+
+// one connection to the service
+class CaptureClient : public QObject {
+	Q_DISABLE_COPY(CaptureClient)
+
+	int fd;
+	QSocketNotifier *notifier;
+	QByteArray input;
+
+	// the reply being written, and the frame to attach to its first byte
+	QSocketNotifier *writeNotifier;
+	QTimer *sendTimer;
+	QByteArray output;
+	qsizetype outputSent;
+	int passFd;
+
+	// a reply is being encoded or written, so the next request waits
+	bool busy;
+	bool closed;
+
+	void readable();
+	void writable();
+	void handleLines();
+	void handle(const QByteArray &line);
+	void sendReply(QByteArray reply, int frame);
+	void replied();
+
+ public:
+	CaptureClient(int fd, QObject *parent);
+	~CaptureClient();
+};
+#endif
+
+#endif	// CAPTURESERVICE_HXX
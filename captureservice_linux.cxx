@@ -0,0 +1,412 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "captureservice.hxx"
+
+#ifdef HAS_CAPTURESERVICE
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QCursor>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QGuiApplication>
+#include <QPainter>
+#include <QPointer>
+#include <QScreen>
+#include <QStandardPaths>
+#include <cerrno>
+#include <cstring>
+
+#include "encodequeue.hxx"
+#include "encoder.hxx"
+#include "platform.hxx"
+#include "trace.hxx"
+
+static const char *SOCKET_FILE_NAME = "sharks.sock";
+// a request line longer than this is garbage, not a request
+static const int MAX_REQUEST_LENGTH = 4096;
+// a client that reads none of its reply for this long is dropped
+static const int SEND_TIMEOUT_MS = 10000;
+
+CaptureService::CaptureService(int fd, QByteArray path, QObject *parent)
+	: QObject(parent), fd(fd), path(std::move(path)) {
+	this->notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+	connect(this->notifier, &QSocketNotifier::activated, this, &CaptureService::accept);
+}
+
+CaptureService *CaptureService::create(QObject *parent) {
+	QDir runtimeDir(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation));
+	QByteArray path = QFile::encodeName(runtimeDir.filePath(SOCKET_FILE_NAME));
+
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if ((size_t)path.size() >= sizeof(addr.sun_path)) {
+		qWarning() << "capture socket path is too long" << path;
+		return nullptr;
+	}
+	memcpy(addr.sun_path, path.constData(), path.size());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		qWarning() << "unable to create capture socket" << strerror(errno);
+		return nullptr;
+	}
+
+	// whoever made the old socket has exited by now, or we wouldn't hold the lock
+	unlink(path.constData());
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+		qWarning() << "unable to listen on" << path << strerror(errno);
+		close(fd);
+		return nullptr;
+	}
+	chmod(path.constData(), 0600);
+
+	return new CaptureService(fd, std::move(path), parent);
+}
+
+CaptureService::~CaptureService() {
+	unlink(this->path.constData());
+	close(this->fd);
+}
+
+void CaptureService::accept() {
+	for (;;) {
+		int client = accept4(this->fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				qWarning() << "unable to accept capture client" << strerror(errno);
+			}
+			if (errno != EINTR) {
+				return;
+			}
+			continue;
+		}
+
+		// the socket lives in our runtime dir, but check anyway since screenshots are private
+		struct ucred cred = {};
+		socklen_t len = sizeof(cred);
+		if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != getuid()) {
+			close(client);
+			continue;
+		}
+
+		new CaptureClient(client, this);
+	}
+}
+
+CaptureClient::CaptureClient(int fd, QObject *parent)
+	: QObject(parent), fd(fd), outputSent(0), passFd(-1), busy(false), closed(false) {
+	this->notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+	connect(this->notifier, &QSocketNotifier::activated, this, &CaptureClient::readable);
+
+	this->writeNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+	this->writeNotifier->setEnabled(false);
+	connect(this->writeNotifier, &QSocketNotifier::activated, this, &CaptureClient::writable);
+
+	this->sendTimer = new QTimer(this);
+	this->sendTimer->setSingleShot(true);
+	this->sendTimer->setInterval(SEND_TIMEOUT_MS);
+	connect(this->sendTimer, &QTimer::timeout, this, [this]() {
+		qWarning() << "dropping capture client that stopped reading";
+		this->closed = true;
+		this->writeNotifier->setEnabled(false);
+		this->deleteLater();
+	});
+}
+
+CaptureClient::~CaptureClient() {
+	if (this->passFd >= 0) {
+		close(this->passFd);
+	}
+	close(this->fd);
+}
+
+void CaptureClient::readable() {
+	char buf[1024];
+	ssize_t n = recv(this->fd, buf, sizeof(buf), MSG_DONTWAIT);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		this->closed = true;
+		this->notifier->setEnabled(false);
+		if (!this->busy) {
+			this->deleteLater();
+		}
+		return;
+	}
+
+	this->input.append(buf, n);
+	this->handleLines();
+}
+
+// sends what it can of data without blocking, with passFd attached to the first byte if it isn't -1
+static ssize_t sendSome(int fd, const char *data, qsizetype len, int passFd) {
+	if (passFd < 0) {
+		return send(fd, data, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+
+	struct iovec iov = {(void *)data, (size_t)len};
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} control = {};
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &passFd, sizeof(int));
+
+	return sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+// copies image into a sealed memfd, so the client can map it without trusting us not to change it
+static int sealedFrame(const QImage &image) {
+	int fd = memfd_create("sharks-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return -1;
+	}
+
+	const char *data = reinterpret_cast<const char *>(image.constBits());
+	qsizetype left = image.sizeInBytes();
+	while (left > 0) {
+		ssize_t n = write(fd, data, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			close(fd);
+			return -1;
+		}
+		data += n;
+		left -= n;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void CaptureClient::handleLines() {
+	while (!this->busy && !this->closed) {
+		qsizetype end = this->input.indexOf('\n');
+		if (end < 0) {
+			if (this->input.size() > MAX_REQUEST_LENGTH) {
+				qWarning() << "dropping capture client with an overlong request";
+				this->closed = true;
+				this->deleteLater();
+			}
+			return;
+		}
+
+		QByteArray line = this->input.left(end).trimmed();
+		this->input.remove(0, end + 1);
+		if (!line.isEmpty()) {
+			this->handle(line);
+		}
+	}
+}
+
+void CaptureClient::handle(const QByteArray &line) {
+	TraceSpan span("service capture", Trace::enabled() ? QString::fromUtf8(line) : QString());
+
+	QRect region = QGuiApplication::primaryScreen()->virtualGeometry();
+	bool cursor = false;
+	const Encoder *encoder = nullptr;
+	int level = -1;
+	QByteArray error;
+
+	auto words = line.split(' ');
+	if (words[0] != "capture") {
+		error = "unknown request " + words[0];
+	}
+	for (qsizetype i = 1; i < words.size() && error.isEmpty(); i++) {
+		const QByteArray &word = words[i];
+		if (word.isEmpty()) {
+			continue;
+		}
+		qsizetype eq = word.indexOf('=');
+		QByteArray key = word.left(eq);
+		QByteArray value = eq < 0 ? QByteArray() : word.mid(eq + 1);
+
+		if (key == "region") {
+			if (!parseRegion(QString::fromUtf8(value), &region)) {
+				error = "region must be x,y,w,h with a positive size";
+			}
+		} else if (key == "output") {
+			QScreen *screen = nullptr;
+			for (QScreen *s : QGuiApplication::screens()) {
+				if (s->name() == QString::fromUtf8(value)) {
+					screen = s;
+				}
+			}
+			if (screen == nullptr) {
+				error = "no output named " + value;
+			} else {
+				region = screen->geometry();
+			}
+		} else if (key == "cursor") {
+			cursor = value == "1";
+			if (!cursor && value != "0") {
+				error = "cursor must be 0 or 1";
+			}
+		} else if (key == "format") {
+			if (value != "raw") {
+				encoder = Encoder::find(QString::fromUtf8(value));
+				if (encoder == nullptr) {
+					error = "unknown format " + value;
+				}
+			}
+		} else if (key == "level") {
+			bool ok = false;
+			level = value.toInt(&ok);
+			if (!ok || level < -1 || level > 9) {
+				error = "level must be -1 to 9";
+			}
+		} else {
+			error = "unknown option " + key;
+		}
+	}
+
+	QImage image;
+	if (error.isEmpty()) {
+		image = platform->getScreenshotImage(region);
+		if (image.isNull()) {
+			error = "unable to capture";
+		}
+	}
+
+	if (error.isEmpty() && cursor) {
+		QImage cursorImage = platform->getCursorImage();
+		QPoint at = QCursor::pos() - cursorImage.offset() - region.topLeft();
+		if (!cursorImage.isNull() && QRect(at, cursorImage.size()).intersects(image.rect())) {
+			// the capture may share its pixels with the backend's buffers, so draw on a copy
+			image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+			QPainter p(&image);
+			p.drawImage(at, cursorImage);
+		}
+	}
+
+	// the capture was the part that needed this thread; encoding happens on the encode queue, and
+	// the reply is written back here without blocking so a slow reader can't hold up its workers
+	this->busy = true;
+	this->notifier->setEnabled(false);
+	QPointer<CaptureClient> self(this);
+	EncodeQueue::instance()->run([self, image = std::move(image), encoder, level, error]() {
+		qint64 start = Trace::now();
+		QByteArray header;
+		QByteArray payload;
+		int frame = -1;
+
+		if (!error.isEmpty()) {
+			header = "error " + error;
+		} else if (encoder == nullptr) {
+			// RGB32 is ARGB32 with an opaque alpha, so only other formats need converting
+			QImage pixels = image;
+			if (pixels.format() != QImage::Format_RGB32 && pixels.format() != QImage::Format_ARGB32_Premultiplied) {
+				pixels = pixels.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+			}
+			frame = sealedFrame(pixels);
+			if (frame < 0) {
+				header = QByteArray("error unable to create frame: ") + strerror(errno);
+			} else {
+				header = QString("ok raw %1 %2 %3 argb32")
+							 .arg(pixels.width())
+							 .arg(pixels.height())
+							 .arg(pixels.bytesPerLine())
+							 .toUtf8();
+			}
+		} else {
+			QBuffer buffer(&payload);
+			buffer.open(QIODevice::WriteOnly);
+			QString encodeError;
+			if (!SaveFormat{encoder, level}.write(image, &buffer, &encodeError)) {
+				header = "error " + encodeError.toUtf8();
+				payload.clear();
+			} else {
+				header = QString("ok %1 %2").arg(QLatin1StringView(encoder->name())).arg(payload.size()).toUtf8();
+			}
+		}
+		header.replace('\n', ' ');
+		header.append('\n');
+		Trace::complete("service encode", start, Trace::now());
+
+		QMetaObject::invokeMethod(QCoreApplication::instance(), [self, reply = header + payload, frame]() {
+			if (self) {
+				self->sendReply(reply, frame);
+			} else if (frame >= 0) {
+				close(frame);
+			}
+		}, Qt::QueuedConnection);
+	});
+}
+
+void CaptureClient::sendReply(QByteArray reply, int frame) {
+	this->output = std::move(reply);
+	this->outputSent = 0;
+	this->passFd = frame;
+	this->sendTimer->start();
+	this->writable();
+}
+
+void CaptureClient::writable() {
+	while (!this->closed && this->outputSent < this->output.size()) {
+		ssize_t n = sendSome(this->fd, this->output.constData() + this->outputSent, this->output.size() - this->outputSent, this->passFd);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				this->writeNotifier->setEnabled(true);
+				return;
+			}
+			qWarning() << "unable to reply to capture client" << strerror(errno);
+			break;
+		}
+
+		if (this->passFd >= 0) {
+			close(this->passFd);
+			this->passFd = -1;
+		}
+		this->outputSent += n;
+		this->sendTimer->start();
+	}
+
+	this->writeNotifier->setEnabled(false);
+	this->sendTimer->stop();
+	if (this->passFd >= 0) {
+		close(this->passFd);
+		this->passFd = -1;
+	}
+	this->output.clear();
+	this->outputSent = 0;
+	this->replied();
+}
+
+void CaptureClient::replied() {
+	this->busy = false;
+	if (this->closed) {
+		this->deleteLater();
+		return;
+	}
+	this->notifier->setEnabled(true);
+	this->handleLines();
+}
+#endif
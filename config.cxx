@@ -19,6 +19,24 @@ static const char *DEFAULT_CONFIG = R"(# default sharks config
 screenshot = ["Ctrl+Print"]
 picker = ["Alt+Print"]
 
+[save]
+# png, png-fast, png-qt (Qt's writer), qoi, or webp (lossless). Actions can set their own format and level
+format = "png"
+# 0 (fastest) to 9 (smallest). -1 uses the format's default
+level = -1
+
+# Chrome trace of each capture, for chrome://tracing or ui.perfetto.dev. Also set by $SHARKS_TRACE
+#[trace]
+#file = "/tmp/sharks-trace.json"
+
+[picker]
+# pixels either side of the cursor shown in the loupe
+radius = 7
+# how many screen pixels each captured pixel takes up in the loupe
+zoom = 8
+# picks the average of an average x average block around the cursor rather than one pixel
+average = 1
+
 [pen]
 key = "P"
 color = 0xFF0000
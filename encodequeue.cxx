@@ -0,0 +1,66 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "encodequeue.hxx"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QSaveFile>
+
+#include "trace.hxx"
+
+EncodeQueue::EncodeQueue(QObject *parent)
+	: QObject(parent) {
+	// a couple of workers so a big save doesn't hold up the next one
+	this->pool.setMaxThreadCount(2);
+}
+
+EncodeQueue *EncodeQueue::instance() {
+	static EncodeQueue *queue = nullptr;
+	if (queue == nullptr) {
+		queue = new EncodeQueue(QCoreApplication::instance());
+		connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, queue, &EncodeQueue::waitForDone);
+	}
+	return queue;
+}
+
+void EncodeQueue::save(QImage image, QString path, SaveFormat format, std::function<void(bool ok)> done) {
+	this->pool.start([image = std::move(image), path, format, done]() {
+		qint64 start = Trace::now();
+		QSaveFile file(path);
+		bool ok = false;
+		if (!file.open(QIODevice::WriteOnly)) {
+			qWarning() << "unable to open" << path << file.errorString();
+		} else {
+			QString error;
+			if (!format.write(image, &file, &error)) {
+				qWarning() << "unable to encode" << path << "as" << format.encoder->name() << error;
+				file.cancelWriting();
+			} else if (!file.commit()) {
+				qWarning() << "unable to write" << path << file.errorString();
+			} else {
+				ok = true;
+			}
+		}
+
+		// the file is the end of a capture, so it's a good time to write the trace out
+		if (Trace::enabled()) {
+			Trace::complete("encode", start, Trace::now(), QString("%1 %2").arg(QLatin1StringView(format.encoder->name()), path));
+			Trace::flush();
+		}
+
+		if (done) {
+			QMetaObject::invokeMethod(QCoreApplication::instance(), [done, ok]() { done(ok); }, Qt::QueuedConnection);
+		}
+	});
+}
+
+void EncodeQueue::run(std::function<void()> job) {
+	this->pool.start(std::move(job));
+}
+
+void EncodeQueue::waitForDone() {
+	this->pool.waitForDone();
+	// deliver the completions queued by the last jobs, so things like exec still happen on exit
+	QCoreApplication::sendPostedEvents(nullptr, QEvent::MetaCall);
+}
@@ -0,0 +1,35 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef ENCODEQUEUE_HXX
+#define ENCODEQUEUE_HXX
+
+#include <QImage>
+#include <QObject>
+#include <QThreadPool>
+#include <functional>
+
+#include "encoder.hxx"
+
+// Encodes and writes screenshots off the GUI thread so a large save doesn't stall hotkeys or the
+// tray. Files are written to a temporary next to the destination and renamed into place.
+class EncodeQueue : public QObject {
+	Q_OBJECT
+	Q_DISABLE_COPY(EncodeQueue)
+
+	QThreadPool pool;
+
+	explicit EncodeQueue(QObject *parent = nullptr);
+
+ public:
+	static EncodeQueue *instance();
+
+	// Takes the image and writes it to path. done runs on the GUI thread afterwards.
+	void save(QImage image, QString path, SaveFormat format, std::function<void(bool ok)> done = {});
+	// Runs other encoding work on the same workers, so it is bounded the same way and finished
+	// before exit
+	void run(std::function<void()> job);
+	void waitForDone();
+};
+
+#endif	// ENCODEQUEUE_HXX
@@ -0,0 +1,360 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "encoder.hxx"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <cstring>
+#include <vector>
+
+#include "config.hxx"
+
+#ifdef SHARKS_HAS_ZLIB
+#include "pngwriter.hxx"
+#endif
+#ifdef SHARKS_HAS_WEBP
+#include <webp/encode.h>
+#endif
+
+// encoders buffer their output and hand it to the device in pieces this big
+static const size_t WRITE_CHUNK = 256 * 1024;
+
+static bool writeAll(QIODevice *out, const void *data, size_t len, QString *error) {
+	if (out->write(reinterpret_cast<const char *>(data), len) != (qint64)len) {
+		*error = out->errorString();
+		return false;
+	}
+	return true;
+}
+
+static void putBE32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// Qt's own writers, through the image format plugins
+class QtEncoder : public Encoder {
+	const char *encoderName;
+	const char *format;
+	const char *desc;
+
+ public:
+	QtEncoder(const char *name, const char *format, const char *desc)
+		: encoderName(name), format(format), desc(desc) {
+	}
+
+	const char *name() const override {
+		return this->encoderName;
+	}
+	const char *suffix() const override {
+		return this->format;
+	}
+	const char *description() const override {
+		return this->desc;
+	}
+
+	bool write(const QImage &image, QIODevice *out, int level, QString *error) const override {
+		QImageWriter writer(out, this->format);
+		if (strcmp(this->format, "webp") == 0) {
+			// the webp plugin only encodes losslessly at full quality, and has no effort setting
+			writer.setQuality(100);
+		} else if (level >= 0) {
+			// zlib level for png
+			writer.setCompression(level);
+		}
+		if (!writer.write(image)) {
+			*error = writer.errorString();
+			return false;
+		}
+		return true;
+	}
+};
+
+#ifdef SHARKS_HAS_ZLIB
+// Our own png writer, see pngwriter.hxx. png and png-fast only differ in their default level
+class PngEncoder : public Encoder {
+	const char *encoderName;
+	const char *desc;
+	int defaultLevel;
+
+ public:
+	PngEncoder(const char *name, const char *desc, int defaultLevel)
+		: encoderName(name), desc(desc), defaultLevel(defaultLevel) {
+	}
+
+	const char *name() const override {
+		return this->encoderName;
+	}
+	const char *suffix() const override {
+		return "png";
+	}
+	const char *description() const override {
+		return this->desc;
+	}
+
+	bool write(const QImage &image, QIODevice *out, int level, QString *error) const override {
+		return writePng(image, out, level < 0 ? this->defaultLevel : level, error);
+	}
+};
+#endif
+
+// The Quite OK Image format (qoiformat.org). There is only one way to encode an image, so
+// level is ignored. It is the fastest of the encoders, at the cost of larger files.
+class QoiEncoder : public Encoder {
+ public:
+	const char *name() const override {
+		return "qoi";
+	}
+	const char *suffix() const override {
+		return "qoi";
+	}
+	const char *description() const override {
+		return "QOI";
+	}
+
+	bool write(const QImage &image, QIODevice *out, int, QString *error) const override {
+		bool alpha = image.hasAlphaChannel();
+		// RGBX has an opaque alpha byte, so both cases are read as r,g,b,a
+		QImage src = image.convertToFormat(alpha ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
+
+		std::vector<uint8_t> buf;
+		buf.reserve(WRITE_CHUNK + 64);
+
+		uint8_t header[14] = {'q', 'o', 'i', 'f'};
+		putBE32(header + 4, src.width());
+		putBE32(header + 8, src.height());
+		header[12] = alpha ? 4 : 3;
+		header[13] = 0;	 // sRGB with linear alpha
+		buf.insert(buf.end(), header, header + sizeof(header));
+
+		uint8_t index[64][4] = {};
+		uint8_t prev[4] = {0, 0, 0, 255};
+		int run = 0;
+
+		for (int y = 0; y < src.height(); y++) {
+			const uint8_t *px = src.constScanLine(y);
+			for (int x = 0; x < src.width(); x++, px += 4) {
+				if (memcmp(px, prev, 4) == 0) {
+					if (++run == 62) {
+						buf.push_back(0xC0 | (run - 1));
+						run = 0;
+					}
+					continue;
+				}
+
+				if (run > 0) {
+					buf.push_back(0xC0 | (run - 1));
+					run = 0;
+				}
+
+				int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+				if (memcmp(index[hash], px, 4) == 0) {
+					buf.push_back(hash);
+				} else {
+					memcpy(index[hash], px, 4);
+					if (px[3] == prev[3]) {
+						int8_t vr = px[0] - prev[0];
+						int8_t vg = px[1] - prev[1];
+						int8_t vb = px[2] - prev[2];
+						int8_t vgr = vr - vg;
+						int8_t vgb = vb - vg;
+						if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+							buf.push_back(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+						} else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8) {
+							buf.push_back(0x80 | (vg + 32));
+							buf.push_back((vgr + 8) << 4 | (vgb + 8));
+						} else {
+							buf.push_back(0xFE);
+							buf.insert(buf.end(), px, px + 3);
+						}
+					} else {
+						buf.push_back(0xFF);
+						buf.insert(buf.end(), px, px + 4);
+					}
+				}
+				memcpy(prev, px, 4);
+			}
+
+			if (buf.size() >= WRITE_CHUNK) {
+				if (!writeAll(out, buf.data(), buf.size(), error)) {
+					return false;
+				}
+				buf.clear();
+			}
+		}
+
+		if (run > 0) {
+			buf.push_back(0xC0 | (run - 1));
+		}
+		static const uint8_t END[] = {0, 0, 0, 0, 0, 0, 0, 1};
+		buf.insert(buf.end(), END, END + sizeof(END));
+		return writeAll(out, buf.data(), buf.size(), error);
+	}
+};
+
+#ifdef SHARKS_HAS_WEBP
+// Lossless webp through libwebp, so the level can pick the effort preset
+class WebpEncoder : public Encoder {
+ public:
+	const char *name() const override {
+		return "webp";
+	}
+	const char *suffix() const override {
+		return "webp";
+	}
+	const char *description() const override {
+		return "WebP, lossless";
+	}
+
+	bool write(const QImage &image, QIODevice *out, int level, QString *error) const override {
+		WebPConfig config;
+		// the higher presets get slow quickly on large images
+		if (!WebPConfigInit(&config) || !WebPConfigLosslessPreset(&config, level < 0 ? 2 : level)) {
+			*error = "unable to initialize libwebp";
+			return false;
+		}
+		config.thread_level = 1;
+
+		bool alpha = image.hasAlphaChannel();
+		QImage src = image.convertToFormat(alpha ? QImage::Format_RGBA8888 : QImage::Format_RGBX8888);
+
+		WebPPicture pic;
+		if (!WebPPictureInit(&pic)) {
+			*error = "unable to initialize libwebp";
+			return false;
+		}
+		pic.use_argb = 1;
+		pic.width = src.width();
+		pic.height = src.height();
+		bool ok = alpha
+			? WebPPictureImportRGBA(&pic, src.constBits(), src.bytesPerLine())
+			: WebPPictureImportRGBX(&pic, src.constBits(), src.bytesPerLine());
+		if (!ok) {
+			*error = "out of memory";
+			WebPPictureFree(&pic);
+			return false;
+		}
+
+		WebPMemoryWriter mem;
+		WebPMemoryWriterInit(&mem);
+		pic.writer = WebPMemoryWrite;
+		pic.custom_ptr = &mem;
+
+		ok = WebPEncode(&config, &pic);
+		if (!ok) {
+			*error = QString("libwebp error %1").arg(pic.error_code);
+		}
+		WebPPictureFree(&pic);
+
+		ok = ok && writeAll(out, mem.mem, mem.size, error);
+		WebPMemoryWriterClear(&mem);
+		return ok;
+	}
+};
+#endif
+
+const QList<const Encoder *> &Encoder::available() {
+	static const QList<const Encoder *> encoders = []() {
+		QList<const Encoder *> list;
+		list.append(Encoder::fallback());
+#ifdef SHARKS_HAS_ZLIB
+		list.append(new PngEncoder("png-fast", "PNG, fast", 0));
+		list.append(new QtEncoder("png-qt", "png", "PNG, Qt"));
+#endif
+		list.append(new QoiEncoder());
+#ifdef SHARKS_HAS_WEBP
+		list.append(new WebpEncoder());
+#else
+		if (QImageWriter::supportedImageFormats().contains("webp")) {
+			list.append(new QtEncoder("webp", "webp", "WebP, lossless"));
+		}
+#endif
+		return list;
+	}();
+	return encoders;
+}
+
+const Encoder *Encoder::find(QStringView name) {
+	for (auto *enc : Encoder::available()) {
+		if (name == QLatin1StringView(enc->name())) {
+			return enc;
+		}
+	}
+	return nullptr;
+}
+
+const Encoder *Encoder::forSuffix(QStringView suffix) {
+	for (auto *enc : Encoder::available()) {
+		if (suffix.compare(QLatin1StringView(enc->suffix()), Qt::CaseInsensitive) == 0) {
+			return enc;
+		}
+	}
+	return nullptr;
+}
+
+const Encoder *Encoder::fallback() {
+#ifdef SHARKS_HAS_ZLIB
+	// libpng's default zlib level, with its filter heuristic
+	static const PngEncoder png("png", "PNG", 6);
+#else
+	static const QtEncoder png("png", "png", "PNG");
+#endif
+	return &png;
+}
+
+SaveFormat SaveFormat::fromConfig(toml::table *action) {
+	SaveFormat format{Encoder::fallback(), -1};
+
+	auto saveTab = Config::get<toml::table>(&config->root, "save", "save should be a table");
+	for (toml::table *tab : {saveTab ? &*saveTab : nullptr, action}) {
+		if (tab == nullptr) {
+			continue;
+		}
+
+		auto name = Config::get<std::string>(tab, "format", "format should be a string");
+		if (name) {
+			auto *enc = Encoder::find(QString::fromStdString(*name));
+			if (enc) {
+				format.encoder = enc;
+			} else {
+				QStringList names;
+				for (auto *e : Encoder::available()) {
+					names.append(e->name());
+				}
+				Config::complain((*tab)["format"], "format should be one of " + names.join(", "));
+			}
+		}
+
+		auto level = Config::get<int64_t>(tab, "level", "level should be an integer");
+		if (level) {
+			if (*level < -1 || *level > 9) {
+				Config::complain((*tab)["level"], "level should be between 0 and 9, or -1");
+			} else {
+				format.level = *level;
+			}
+		}
+	}
+
+	return format;
+}
+
+SaveFormat SaveFormat::forPath(const QString &path) const {
+	QString suffix = QFileInfo(path).suffix();
+	if (suffix.compare(QLatin1StringView(this->encoder->suffix()), Qt::CaseInsensitive) == 0) {
+		return *this;
+	}
+
+	auto *enc = Encoder::forSuffix(suffix);
+	if (enc == nullptr) {
+		return *this;
+	}
+	return {enc, this->level};
+}
+
+bool SaveFormat::write(const QImage &image, QIODevice *out, QString *error) const {
+	return this->encoder->write(image, out, this->level, error);
+}
@@ -0,0 +1,50 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef ENCODER_HXX
+#define ENCODER_HXX
+
+#include <QIODevice>
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <toml++/toml.hpp>
+
+// A lossless image format screenshots can be written in. Encoders are stateless singletons
+// and may be used from several threads at once.
+class Encoder {
+ public:
+	virtual ~Encoder() = default;
+
+	// name used in the config
+	virtual const char *name() const = 0;
+	// file extension, without the dot
+	virtual const char *suffix() const = 0;
+	// shown in the save-as dialog
+	virtual const char *description() const = 0;
+
+	// level is 0 (fastest) to 9 (smallest), or -1 for the encoder's default
+	virtual bool write(const QImage &image, QIODevice *out, int level, QString *error) const = 0;
+
+	// encoders that can be used in this build
+	static const QList<const Encoder *> &available();
+	static const Encoder *find(QStringView name);
+	// first available encoder writing files with the suffix, or nullptr
+	static const Encoder *forSuffix(QStringView suffix);
+	// png, used when nothing else is configured
+	static const Encoder *fallback();
+};
+
+// An encoder and the level to run it at
+struct SaveFormat {
+	const Encoder *encoder;
+	int level;
+
+	// reads format and level from action, falling back to the [save] table
+	static SaveFormat fromConfig(toml::table *action = nullptr);
+	// returns format, or an encoder for path's suffix if format doesn't write that suffix
+	SaveFormat forPath(const QString &path) const;
+	bool write(const QImage &image, QIODevice *out, QString *error) const;
+};
+
+#endif	// ENCODER_HXX
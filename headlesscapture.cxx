@@ -0,0 +1,106 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "headlesscapture.hxx"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImageWriter>
+#include <QSaveFile>
+#include <QScreen>
+#include <cstring>
+
+#include "encoder.hxx"
+#include "platform.hxx"
+
+static const QCommandLineOption captureOption("capture", "Takes a screenshot without any UI, writes it to --output and exits");
+static const QCommandLineOption regionOption("region", "Area for --capture, in virtual desktop coordinates. Defaults to the whole desktop", "x,y,w,h");
+static const QCommandLineOption outputOption("output", "File for --capture to write, or - for stdout", "file", "-");
+
+bool HeadlessCapture::requested(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--capture") == 0 || strcmp(argv[i], "-capture") == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void HeadlessCapture::addOptions(QCommandLineParser &cli) {
+	cli.addOption(captureOption);
+	cli.addOption(regionOption);
+	cli.addOption(outputOption);
+}
+
+bool HeadlessCapture::checkUnused(QCommandLineParser &cli) {
+	for (const QCommandLineOption &option : {regionOption, outputOption}) {
+		if (cli.isSet(option)) {
+			qWarning().noquote() << "--" + option.names().first() << "only applies to --capture";
+			return false;
+		}
+	}
+	return true;
+}
+
+int HeadlessCapture::run(QCommandLineParser &cli) {
+	QRect region = QGuiApplication::primaryScreen()->virtualGeometry();
+	if (cli.isSet(regionOption) && !parseRegion(cli.value(regionOption), &region)) {
+		qWarning() << "--region must be x,y,w,h with a positive size";
+		return 2;
+	}
+
+	QImage img = platform->getScreenshotImage(region);
+	if (img.isNull()) {
+		qWarning() << "unable to capture" << region;
+		return 1;
+	}
+
+	QString path = cli.value(outputOption);
+	SaveFormat format{Encoder::fallback(), -1};
+	if (path == "-") {
+		QFile out;
+		if (!out.open(stdout, QFile::WriteOnly)) {
+			qWarning() << "unable to open stdout";
+			return 1;
+		}
+
+		QString error;
+		if (!format.write(img, &out, &error)) {
+			qWarning() << "unable to write screenshot" << error;
+			return 1;
+		}
+		return 0;
+	}
+
+	// written next to the destination and renamed over it, so a failed encode leaves what was there
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly)) {
+		qWarning() << "unable to open" << path << file.errorString();
+		return 1;
+	}
+
+	QString suffix = QFileInfo(path).suffix();
+	if (!suffix.isEmpty() && Encoder::forSuffix(suffix) == nullptr) {
+		// not one of ours, but qt may still know it
+		QImageWriter writer(&file, suffix.toLower().toUtf8());
+		if (!writer.write(img)) {
+			qWarning() << "unable to write screenshot" << writer.errorString();
+			file.cancelWriting();
+			return 1;
+		}
+	} else {
+		QString error;
+		if (!format.forPath(path).write(img, &file, &error)) {
+			qWarning() << "unable to write screenshot" << error;
+			file.cancelWriting();
+			return 1;
+		}
+	}
+
+	if (!file.commit()) {
+		qWarning() << "unable to write" << path << file.errorString();
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,21 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef HEADLESSCAPTURE_HXX
+#define HEADLESSCAPTURE_HXX
+
+#include <QCommandLineParser>
+
+// `sharks --capture` grabs the screen, encodes it and exits without ever creating a widget,
+// so it runs under a plain QGuiApplication.
+class HeadlessCapture {
+ public:
+	// checked before the application exists, since it decides which application to make
+	static bool requested(int argc, char *argv[]);
+	static void addOptions(QCommandLineParser &cli);
+	// for the GUI parser, where --capture wasn't given; warns and returns false if its options were
+	static bool checkUnused(QCommandLineParser &cli);
+	static int run(QCommandLineParser &cli);
+};
+
+#endif	// HEADLESSCAPTURE_HXX
@@ -5,13 +5,16 @@
 #define KILLEXISTING_HXX
 
 #include <QtGlobal>
+#include <functional>
 
 #ifdef Q_OS_LINUX
 #define HAS_KILLEXISTING
 #endif
 
 #ifdef HAS_KILLEXISTING
-void setupKillExisting();
+// Listens for SIGUSR1 requests and replaces any running instance. acquired runs once the old
+// instance has exited, or it has been given up on.
+void setupKillExisting(std::function<void()> acquired);
 #endif
 
 #endif	// KILLEXISTING_HXX
@@ -4,16 +4,26 @@
 #include "killexisting.hxx"
 
 #ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include <QApplication>
+#include <QDeadlineTimer>
 #include <QDebug>
 #include <QDir>
+#include <QFile>
 #include <QSocketNotifier>
+#include <QStandardPaths>
+#include <QTimer>
 #include <csignal>
+#include <cstring>
+#include <memory>
 
 #include "selectionwindow.hxx"
+#include "trace.hxx"
 
 static const quint32 MAGIC_SIG_EXIT = 'SKEX';
 static const quint32 MAGIC_SIG_SCREENSHOT = 'SKSC';
@@ -28,7 +38,146 @@ void sigusr1Action(int sig, siginfo_t *info, void *ucontext) {
 	write(sigNotifierFd[0], &v, sizeof(v));
 }
 
-void setupKillExisting() {
+// Only one instance holds an flock on this file, and its pid is written inside. A new instance
+// asks the holder to exit and waits on a pidfd for it to be gone, so the old hotkey grabs are
+// released by the time the lock is ours.
+static const char *LOCK_FILE_NAME = "sharks.lock";
+// how long to wait for the old instance before carrying on without the lock
+static const int HANDOFF_TIMEOUT_MS = 5000;
+// how often to look again when there is no pidfd to wait on
+static const int HANDOFF_POLL_MS = 50;
+
+// held open for the life of the process, since closing it drops the lock
+static int lockFd = -1;
+
+struct Handoff {
+	std::function<void()> acquired;
+	QDeadlineTimer deadline;
+	pid_t signalled;
+};
+
+static bool tryLock() {
+	if (flock(lockFd, LOCK_EX | LOCK_NB) != 0) {
+		return false;
+	}
+
+	QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+	if (ftruncate(lockFd, 0) != 0 || pwrite(lockFd, pid.constData(), pid.size(), 0) != pid.size()) {
+		qWarning() << "unable to write lock file" << strerror(errno);
+	}
+	return true;
+}
+
+static pid_t lockHolder() {
+	char buf[32];
+	ssize_t n = pread(lockFd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0) {
+		// the holder has taken the lock but not written its pid yet
+		return 0;
+	}
+	buf[n] = 0;
+	return atoi(buf);
+}
+
+static int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static bool pidfdSendExit(int pidfd) {
+#ifdef SYS_pidfd_send_signal
+	siginfo_t info = {};
+	info.si_signo = SIGUSR1;
+	info.si_code = SI_QUEUE;
+	info.si_pid = getpid();
+	info.si_uid = getuid();
+	info.si_int = MAGIC_SIG_EXIT;
+	return syscall(SYS_pidfd_send_signal, pidfd, SIGUSR1, &info, 0) == 0;
+#else
+	Q_UNUSED(pidfd);
+	errno = ENOSYS;
+	return false;
+#endif
+}
+
+static void takeOver(std::shared_ptr<Handoff> handoff) {
+	if (tryLock()) {
+		handoff->acquired();
+		return;
+	}
+	if (handoff->deadline.hasExpired()) {
+		qWarning() << "another instance is still holding" << LOCK_FILE_NAME << "; carrying on without it";
+		handoff->acquired();
+		return;
+	}
+
+	auto retry = [handoff]() {
+		QTimer::singleShot(HANDOFF_POLL_MS, QCoreApplication::instance(), [handoff]() {
+			takeOver(handoff);
+		});
+	};
+
+	pid_t pid = lockHolder();
+	int pidfd = pid > 0 ? pidfdOpen(pid) : -1;
+	bool noPidfd = pidfd < 0 && errno == ENOSYS;
+
+	// The holder may have exited since its pid was read, and the pid been reused by something that
+	// SIGUSR1 would kill. So only signal once the lock is seen still held by that same pid, after
+	// the pidfd has pinned it.
+	if (pid > 0) {
+		bool locked = tryLock();
+		if (locked || lockHolder() != pid) {
+			if (pidfd >= 0) {
+				close(pidfd);
+			}
+			if (locked) {
+				handoff->acquired();
+			} else {
+				retry();
+			}
+			return;
+		}
+	}
+
+	if (pidfd >= 0) {
+		qInfo() << "asking" << pid << "to exit";
+		if (!pidfdSendExit(pidfd)) {
+			qWarning() << "unable to signal" << pid << strerror(errno);
+		}
+
+		// a pidfd becomes readable once the process is gone
+		auto *exited = new QSocketNotifier(pidfd, QSocketNotifier::Read, QCoreApplication::instance());
+		auto *timeout = new QTimer(exited);
+		timeout->setSingleShot(true);
+		auto next = [=]() {
+			exited->setEnabled(false);
+			timeout->stop();
+			exited->deleteLater();
+			close(pidfd);
+			takeOver(handoff);
+		};
+		QObject::connect(exited, &QSocketNotifier::activated, exited, next);
+		QObject::connect(timeout, &QTimer::timeout, exited, next);
+		timeout->start(qMax<qint64>(0, handoff->deadline.remainingTime()));
+		return;
+	}
+
+	if (pid > 0 && noPidfd && handoff->signalled != pid) {
+		// no pidfds on this kernel; signal by pid and poll the lock instead
+		qInfo() << "asking" << pid << "to exit";
+		union sigval sig = {};
+		sig.sival_int = MAGIC_SIG_EXIT;
+		sigqueue(pid, SIGUSR1, sig);
+		handoff->signalled = pid;
+	}
+	retry();
+}
+
+void setupKillExisting(std::function<void()> acquired) {
 	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sigNotifierFd)) {
 		qWarning() << "unable to create kill socket notifier";
 	}
@@ -37,15 +186,16 @@ void setupKillExisting() {
 	QObject::connect(exitNotifier, &QSocketNotifier::activated, []() {
 		quint32 a;
 		read(sigNotifierFd[1], &a, sizeof(a));
+		Trace::instant("trigger", "SIGUSR1");
 
 		if (a == MAGIC_SIG_EXIT) {
 			qInfo() << "Killed by new instance";
 			QApplication::exit(0);
 		} else if (a == MAGIC_SIG_SCREENSHOT) {
-			auto *win = new SelectionWindow();
+			auto *win = SelectionWindow::capture();
 			win->setVisible(true);
 		} else if (a == MAGIC_SIG_PICKER) {
-			auto *win = new SelectionWindow();
+			auto *win = SelectionWindow::capture();
 			win->setPicking(true);
 			win->setVisible(true);
 		}
@@ -57,54 +207,15 @@ void setupKillExisting() {
 	act.sa_sigaction = sigusr1Action;
 	sigaction(SIGUSR1, &act, nullptr);
 
-	qint64 myPid = QApplication::applicationPid();
-
-	// for some reason QDirIterator is about 1000 times slower than entryList
-	const auto dirEntries = QDir("/proc/").entryList();
-	for (const QString &fileName : dirEntries) {
-		QString filePath = "/proc/" + fileName;
-		qint64 pid = fileName.toLongLong();
-		if (pid == 0 || pid == myPid) {
-			continue;
-		}
-
-		{
-			QFile cmdlineFile(filePath + "/cmdline");
-			if (!cmdlineFile.open(QFile::ReadOnly)) {
-				continue;
-			}
-			QByteArray cmdline = cmdlineFile.readAll();
-			auto procName = cmdline.split(0).at(0);
-			if (procName != "sharks" && !procName.endsWith("/sharks")) {
-				continue;
-			}
-		}
-
-		{
-			QFile statusFile(filePath + "/status");
-			if (!statusFile.open(QFile::ReadOnly)) {
-				qWarning() << "unable to read status for pid" << pid;
-				continue;
-			}
-			for (QByteArray &line : statusFile.readAll().split('\n')) {
-				QList<QByteArray> parts = line.split(':');
-				if (parts.at(0) == "Tgid") {
-					qint64 tgid = parts.at(1).trimmed().toLongLong();
-					if (tgid != pid) {
-						// this is a thread, not the actual process
-						goto nextfile;
-					}
-				}
-			}
-		}
-
-		{
-			qInfo() << "asking" << pid << "to exit";
-			union sigval sig = {};
-			sig.sival_int = MAGIC_SIG_EXIT;
-			sigqueue(pid, SIGUSR1, sig);
-		}
-	nextfile:;
+	QDir runtimeDir(QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation));
+	QByteArray lockPath = QFile::encodeName(runtimeDir.filePath(LOCK_FILE_NAME));
+	lockFd = open(lockPath.constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (lockFd < 0) {
+		qWarning() << "unable to open" << lockPath << strerror(errno);
+		acquired();
+		return;
 	}
+
+	takeOver(std::make_shared<Handoff>(Handoff{std::move(acquired), QDeadlineTimer(HANDOFF_TIMEOUT_MS), 0}));
 }
 #endif
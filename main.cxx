@@ -3,18 +3,40 @@
 // file, You can obtain one at https://mozilla.org/MPL/2.0/.
 #include <QApplication>
 #include <QCommandLineParser>
-#include <QLabel>
+#include <future>
 
+#include "captureservice.hxx"
 #include "config.hxx"
+#include "headlesscapture.hxx"
 #include "killexisting.hxx"
 #include "platform.hxx"
 #include "selectionwindow.hxx"
+#include "trace.hxx"
 #include "traymenu.hxx"
 
 int main(int argc, char *argv[]) {
+	if (HeadlessCapture::requested(argc, argv)) {
+		QGuiApplication app(argc, argv);
+		QGuiApplication::setApplicationName("sharks");
+		Trace::init(qEnvironmentVariable("SHARKS_TRACE"));
+
+		Platform::init();
+
+		QCommandLineParser cli;
+		cli.addHelpOption();
+		HeadlessCapture::addOptions(cli);
+		cli.process(app);
+
+		return HeadlessCapture::run(cli);
+	}
+
 	QApplication app(argc, argv);
 	QApplication::setApplicationName("sharks");
 	QApplication::setApplicationDisplayName("Sharks");
+	Trace::init(qEnvironmentVariable("SHARKS_TRACE"));
+
+	// the config doesn't depend on the display, so parse it while the platform connects
+	auto configReady = std::async(std::launch::async, &Config::init);
 
 	Platform::init();
 
@@ -25,38 +47,55 @@ int main(int argc, char *argv[]) {
 	QCommandLineOption now("now", "Immediately takes a screenshot and exits");
 	cli.addOption(now);
 
+	HeadlessCapture::addOptions(cli);
+
 #ifdef HAS_KILLEXISTING
 	QCommandLineOption noKillOther("nokill", "Don't kill existing instances");
 	cli.addOption(noKillOther);
 #endif
 
 	cli.process(app);
+	if (!HeadlessCapture::checkUnused(cli)) {
+		return 2;
+	}
 
-	Config::init();
-
-	{
-		QLabel foo("foo");
-		// Calling this early saves some time opening the screenshot window, since it can be quite slow to load the default fonts
-		foo.minimumSizeHint();
+	configReady.wait();
+	if (auto traceTab = Config::get<toml::table>(&config->root, "trace", "trace should be a table")) {
+		auto file = Config::get<std::string>(&*traceTab, "file", "file should be a string");
+		if (file) {
+			Trace::init(QString::fromStdString(*file));
+		}
 	}
 
 	if (cli.isSet(now)) {
-		auto *w = new SelectionWindow;
+		auto *w = SelectionWindow::capture();
 		w->setAttribute(Qt::WA_QuitOnClose);
 		w->setVisible(true);
 		return app.exec();
 	}
 
+	app.setQuitOnLastWindowClosed(false);
+
+	TrayMenu m;
+	m.createTrayIcon();
+
 #ifdef HAS_KILLEXISTING
 	if (!cli.isSet(noKillOther)) {
-		setupKillExisting();
+		setupKillExisting([&m, &app]() {
+			m.registerHotkeys();
+#ifdef HAS_CAPTURESERVICE
+			// the socket belongs to whoever holds the lock, so it only moves over with it
+			CaptureService::create(&app);
+#endif
+		});
+	} else {
+		m.registerHotkeys();
 	}
+#else
+	m.registerHotkeys();
 #endif
 
-	app.setQuitOnLastWindowClosed(false);
-
-	TrayMenu m;
-	m.createTrayIcon();
+	SelectionWindow::enablePrewarm();
 
 	return app.exec();
 }
@@ -0,0 +1,309 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "pixelkernels.hxx"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHARKS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static inline uint32_t premultiplyPixel(uint32_t px) {
+	uint32_t a = px >> 24;
+	uint32_t rb = (px & 0xFF00FF) * a + 0x800080;
+	rb = ((rb + ((rb >> 8) & 0xFF00FF)) >> 8) & 0xFF00FF;
+	uint32_t g = ((px >> 8) & 0xFF) * a + 0x80;
+	g = ((g + (g >> 8)) >> 8) & 0xFF;
+	return (a << 24) | rb | (g << 8);
+}
+
+static void fillAlphaScalar(uint32_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		data[i] |= 0xFF000000;
+	}
+}
+
+static void swapRedBlueScalar(uint32_t *dst, const uint32_t *src, size_t len, bool opaque) {
+	uint32_t alpha = opaque ? 0xFF000000 : 0;
+	for (size_t i = 0; i < len; i++) {
+		uint32_t px = src[i];
+		dst[i] = (px & 0xFF00FF00) | ((px >> 16) & 0xFF) | ((px & 0xFF) << 16) | alpha;
+	}
+}
+
+static void expand24Scalar(uint32_t *dst, const uint8_t *src, size_t len, bool swap) {
+	if (swap) {
+		for (size_t i = 0; i < len; i++, src += 3) {
+			dst[i] = 0xFF000000 | (uint32_t(src[0]) << 16) | (uint32_t(src[1]) << 8) | src[2];
+		}
+	} else {
+		for (size_t i = 0; i < len; i++, src += 3) {
+			dst[i] = 0xFF000000 | (uint32_t(src[2]) << 16) | (uint32_t(src[1]) << 8) | src[0];
+		}
+	}
+}
+
+static void premultiplyScalar(uint32_t *data, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		uint32_t px = data[i];
+		uint32_t a = px >> 24;
+		if (a != 0xFF) {
+			data[i] = premultiplyPixel(px);
+		}
+	}
+}
+
+static const PixelKernels scalarKernels{
+	.fillAlpha = fillAlphaScalar,
+	.swapRedBlue = swapRedBlueScalar,
+	.expand24 = expand24Scalar,
+	.premultiply = premultiplyScalar,
+	.name = "scalar",
+};
+
+#ifdef SHARKS_X86_KERNELS
+
+__attribute__((target("sse2"))) static void fillAlphaSSE2(uint32_t *data, size_t len) {
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		auto *p = reinterpret_cast<__m128i *>(data + i);
+		_mm_storeu_si128(p, _mm_or_si128(_mm_loadu_si128(p), alpha));
+	}
+	fillAlphaScalar(data + i, len - i);
+}
+
+__attribute__((target("sse2"))) static void swapRedBlueSSE2(uint32_t *dst, const uint32_t *src, size_t len, bool opaque) {
+	const __m128i alpha = _mm_set1_epi32(opaque ? 0xFF000000 : 0);
+	const __m128i low = _mm_set1_epi32(0xFF);
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		__m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+		__m128i out = _mm_or_si128(_mm_and_si128(px, _mm_set1_epi32(0xFF00FF00)), alpha);
+		out = _mm_or_si128(out, _mm_and_si128(_mm_srli_epi32(px, 16), low));
+		out = _mm_or_si128(out, _mm_slli_epi32(_mm_and_si128(px, low), 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), out);
+	}
+	swapRedBlueScalar(dst + i, src + i, len - i, opaque);
+}
+
+// SSE2 has no byte shuffle, so 3 to 4 byte expansion is left to the scalar loop here
+__attribute__((target("sse2"))) static void premultiplySSE2(uint32_t *data, size_t len) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(0x80);
+	const __m128i alphaMask = _mm_set1_epi32(0xFF000000);
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		auto *p = reinterpret_cast<__m128i *>(data + i);
+		__m128i px = _mm_loadu_si128(p);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, alphaMask), alphaMask)) == 0xFFFF) {
+			continue;
+		}
+
+		__m128i lo = _mm_unpacklo_epi8(px, zero);
+		__m128i hi = _mm_unpackhi_epi8(px, zero);
+		__m128i loA = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		__m128i hiA = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+		lo = _mm_add_epi16(_mm_mullo_epi16(lo, loA), round);
+		hi = _mm_add_epi16(_mm_mullo_epi16(hi, hiA), round);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		__m128i out = _mm_packus_epi16(lo, hi);
+		out = _mm_or_si128(_mm_andnot_si128(alphaMask, out), _mm_and_si128(px, alphaMask));
+		_mm_storeu_si128(p, out);
+	}
+	premultiplyScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void fillAlphaAVX2(uint32_t *data, size_t len) {
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		auto *p = reinterpret_cast<__m256i *>(data + i);
+		_mm256_storeu_si256(p, _mm256_or_si256(_mm256_loadu_si256(p), alpha));
+	}
+	fillAlphaScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) static void swapRedBlueAVX2(uint32_t *dst, const uint32_t *src, size_t len, bool opaque) {
+	const __m256i shuffle = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	const __m256i alpha = _mm256_set1_epi32(opaque ? 0xFF000000 : 0);
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		__m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(_mm256_shuffle_epi8(px, shuffle), alpha));
+	}
+	swapRedBlueScalar(dst + i, src + i, len - i, opaque);
+}
+
+__attribute__((target("avx2"))) static void expand24AVX2(uint32_t *dst, const uint8_t *src, size_t len, bool swap) {
+	// each 128 bit lane takes 4 pixels out of 16 loaded bytes, so stop while a full load is still in bounds
+	const __m256i shuffle = swap
+		? _mm256_setr_epi8(
+				2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+				2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1)
+		: _mm256_setr_epi8(
+				0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+				0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	size_t i = 0;
+	for (; i + 10 <= len; i += 8) {
+		const uint8_t *s = src + i * 3;
+		__m256i px = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s))),
+			_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 12)), 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_or_si256(_mm256_shuffle_epi8(px, shuffle), alpha));
+	}
+	expand24Scalar(dst + i, src + i * 3, len - i, swap);
+}
+
+__attribute__((target("avx2"))) static void premultiplyAVX2(uint32_t *data, size_t len) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i round = _mm256_set1_epi16(0x80);
+	const __m256i alphaMask = _mm256_set1_epi32(0xFF000000);
+	const __m256i alphaShuffle = _mm256_setr_epi8(
+		6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+		6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8) {
+		auto *p = reinterpret_cast<__m256i *>(data + i);
+		__m256i px = _mm256_loadu_si256(p);
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_and_si256(px, alphaMask), alphaMask)) == -1) {
+			continue;
+		}
+
+		__m256i lo = _mm256_unpacklo_epi8(px, zero);
+		__m256i hi = _mm256_unpackhi_epi8(px, zero);
+		lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, _mm256_shuffle_epi8(lo, alphaShuffle)), round);
+		hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, _mm256_shuffle_epi8(hi, alphaShuffle)), round);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+		__m256i out = _mm256_packus_epi16(lo, hi);
+		out = _mm256_or_si256(_mm256_andnot_si256(alphaMask, out), _mm256_and_si256(px, alphaMask));
+		_mm256_storeu_si256(p, out);
+	}
+	premultiplyScalar(data + i, len - i);
+}
+
+static const PixelKernels sse2Kernels{
+	.fillAlpha = fillAlphaSSE2,
+	.swapRedBlue = swapRedBlueSSE2,
+	.expand24 = expand24Scalar,
+	.premultiply = premultiplySSE2,
+	.name = "sse2",
+};
+
+static const PixelKernels avx2Kernels{
+	.fillAlpha = fillAlphaAVX2,
+	.swapRedBlue = swapRedBlueAVX2,
+	.expand24 = expand24AVX2,
+	.premultiply = premultiplyAVX2,
+	.name = "avx2",
+};
+
+#endif
+
+const PixelKernels &PixelKernels::get() {
+	static const PixelKernels *kernels = []() {
+#ifdef SHARKS_X86_KERNELS
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return &avx2Kernels;
+		}
+		if (__builtin_cpu_supports("sse2")) {
+			return &sse2Kernels;
+		}
+#endif
+		return &scalarKernels;
+	}();
+	return *kernels;
+}
+
+// dst = (ax * sx + bx * sy + cx, ay * sx + by * sy + cy), with c given in terms of the source size
+struct TransformCoefficients {
+	int32_t ax, bx, ay, by;
+	bool cxWidth, cxHeight, cyWidth, cyHeight;
+};
+
+static const TransformCoefficients transforms[8] = {
+	{1, 0, 0, 1, false, false, false, false},
+	{0, -1, 1, 0, false, true, false, false},
+	{-1, 0, 0, -1, true, false, false, true},
+	{0, 1, -1, 0, false, false, true, false},
+	{-1, 0, 0, 1, true, false, false, false},
+	{0, -1, -1, 0, false, true, true, false},
+	{1, 0, 0, -1, false, false, false, true},
+	{0, 1, 1, 0, false, false, false, false},
+};
+
+static void transformPoint(const TransformCoefficients &t, int32_t width, int32_t height, int32_t sx, int32_t sy, int32_t *dx, int32_t *dy) {
+	int32_t cx = (t.cxWidth ? width - 1 : 0) + (t.cxHeight ? height - 1 : 0);
+	int32_t cy = (t.cyWidth ? width - 1 : 0) + (t.cyHeight ? height - 1 : 0);
+	*dx = t.ax * sx + t.bx * sy + cx;
+	*dy = t.ay * sx + t.by * sy + cy;
+}
+
+PixelRect transformRect(PixelRect rect, int32_t width, int32_t height, int transform) {
+	const auto &t = transforms[transform & 7];
+	int32_t x0, y0, x1, y1;
+	transformPoint(t, width, height, rect.x, rect.y, &x0, &y0);
+	transformPoint(t, width, height, rect.x + rect.width - 1, rect.y + rect.height - 1, &x1, &y1);
+	return PixelRect{
+		std::min(x0, x1),
+		std::min(y0, y1),
+		std::abs(x1 - x0) + 1,
+		std::abs(y1 - y0) + 1,
+	};
+}
+
+PixelRect untransformRect(PixelRect rect, int32_t width, int32_t height, int transform) {
+	// every transform is its own inverse except the two plain quarter turns
+	int inverse = transform & 7;
+	if (inverse == 1 || inverse == 3) {
+		inverse ^= 2;
+	}
+	if (transform & 1) {
+		std::swap(width, height);
+	}
+	return transformRect(rect, width, height, inverse);
+}
+
+void blitTransformed(uint32_t *dst, ptrdiff_t dstStride, const uint32_t *src, ptrdiff_t srcStride, int32_t width, int32_t height, int transform, PixelRect rect) {
+	const auto &t = transforms[transform & 7];
+	ptrdiff_t dstPitch = dstStride / sizeof(uint32_t);
+	ptrdiff_t srcPitch = srcStride / sizeof(uint32_t);
+
+	if ((transform & 7) == 0) {
+		for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+			memcpy(dst + y * dstPitch + rect.x, src + y * srcPitch + rect.x, rect.width * sizeof(uint32_t));
+		}
+		return;
+	}
+
+	// work in tiles so the column walk of the quarter turns stays in cache
+	const int32_t TILE = 64;
+	ptrdiff_t step = t.ax + t.ay * dstPitch;
+	for (int32_t ty = rect.y; ty < rect.y + rect.height; ty += TILE) {
+		int32_t tyEnd = std::min(ty + TILE, rect.y + rect.height);
+		for (int32_t tx = rect.x; tx < rect.x + rect.width; tx += TILE) {
+			int32_t txEnd = std::min(tx + TILE, rect.x + rect.width);
+			for (int32_t sy = ty; sy < tyEnd; sy++) {
+				int32_t dx, dy;
+				transformPoint(t, width, height, tx, sy, &dx, &dy);
+				uint32_t *d = dst + dy * dstPitch + dx;
+				const uint32_t *s = src + sy * srcPitch;
+				for (int32_t sx = tx; sx < txEnd; sx++, d += step) {
+					*d = s[sx];
+				}
+			}
+		}
+	}
+}
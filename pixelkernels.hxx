@@ -0,0 +1,46 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef PIXELKERNELS_HXX
+#define PIXELKERNELS_HXX
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-pixel conversions used by the capture backends. Pixels are native-endian 0xAARRGGBB,
+// same as QImage::Format_ARGB32. The implementation is picked once at runtime from the
+// instruction sets the CPU supports.
+struct PixelKernels {
+	// sets alpha to 0xFF
+	void (*fillAlpha)(uint32_t *data, size_t len);
+	// swaps the red and blue channels, optionally setting alpha to 0xFF. dst may equal src
+	void (*swapRedBlue)(uint32_t *dst, const uint32_t *src, size_t len, bool opaque);
+	// expands packed 24 bit B,G,R bytes (or R,G,B if swap is set) into opaque pixels
+	void (*expand24)(uint32_t *dst, const uint8_t *src, size_t len, bool swap);
+	// converts ARGB32 to ARGB32_Premultiplied in place
+	void (*premultiply)(uint32_t *data, size_t len);
+
+	const char *name;
+
+	static const PixelKernels &get();
+};
+
+struct PixelRect {
+	int32_t x;
+	int32_t y;
+	int32_t width;
+	int32_t height;
+};
+
+// The eight wl_output transforms: 0-3 rotate clockwise by 0, 90, 180 or 270 degrees,
+// 4-7 mirror horizontally and then rotate the same way.
+
+// Maps rect inside a width x height buffer to where it lands once the buffer is transformed
+PixelRect transformRect(PixelRect rect, int32_t width, int32_t height, int transform);
+// Maps rect inside the transformed buffer back into the width x height source buffer
+PixelRect untransformRect(PixelRect rect, int32_t width, int32_t height, int transform);
+// Copies rect out of a width x height src buffer into dst, which points at the origin of the
+// transformed buffer. Strides are in bytes.
+void blitTransformed(uint32_t *dst, ptrdiff_t dstStride, const uint32_t *src, ptrdiff_t srcStride, int32_t width, int32_t height, int transform, PixelRect rect);
+
+#endif	// PIXELKERNELS_HXX
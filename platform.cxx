@@ -5,6 +5,7 @@
 #include "platform.hxx"
 
 #include <QCursor>
+#include <QPainter>
 #include <QScreen>
 
 #include "wayland/waylandplatform.hxx"
@@ -48,20 +49,83 @@ QImage Platform::getCursorImage() {
 	return img;
 }
 
+void Platform::trackOpenWindows() {
+}
+void Platform::prepareOpenWindows() {
+}
 QList<OpenWindow> Platform::getOpenWindows() {
 	return {};
 }
 QPixmap Platform::getScreenshot(QRect geometry) {
-	auto *screen = QGuiApplication::primaryScreen();
+	return QPixmap::fromImage(this->getScreenshotImage(geometry));
+}
+QImage Platform::getScreenshotImage(QRect geometry) {
+	const auto screens = QGuiApplication::screens();
+	QList<QScreen *> intersecting;
+	for (auto *screen : screens) {
+		if (screen->geometry().intersects(geometry)) {
+			intersecting.push_back(screen);
+		}
+	}
 
-	// you can only grab relative to the screen, but it works to grab the whole virtual desktop
-	auto screenGeometry = screen->geometry();
-	return screen->grabWindow(0, -screenGeometry.x(), -screenGeometry.y(), geometry.width(), geometry.height());
+	// grabs are relative to the screen, so one that fits on a single screen needs no compositing
+	if (intersecting.size() == 1 && intersecting.first()->geometry().contains(geometry)) {
+		auto *screen = intersecting.first();
+		QPoint pos = geometry.topLeft() - screen->geometry().topLeft();
+		return screen->grabWindow(0, pos.x(), pos.y(), geometry.width(), geometry.height()).toImage();
+	}
+
+	QImage out(geometry.size(), QImage::Format_ARGB32_Premultiplied);
+	out.fill(Qt::transparent);
+	QPainter p(&out);
+	for (auto *screen : std::as_const(intersecting)) {
+		QRect part = screen->geometry().intersected(geometry);
+		QPoint pos = part.topLeft() - screen->geometry().topLeft();
+		p.drawPixmap(part.topLeft() - geometry.topLeft(), screen->grabWindow(0, pos.x(), pos.y(), part.width(), part.height()));
+	}
+	return out;
+}
+
+QList<ScreenTile> Platform::getScreenshotTiles(QRect geometry) {
+	QList<ScreenTile> tiles;
+	const auto screens = QGuiApplication::screens();
+	for (auto *screen : screens) {
+		QRect part = screen->geometry().intersected(geometry);
+		if (!part.isEmpty()) {
+			tiles.push_back(ScreenTile{part, this->getScreenshotImage(part)});
+		}
+	}
+	return tiles;
+}
+
+QImage Platform::getScreenshotIncremental(QRect geometry, QRegion *damage, int timeoutMs) {
+	Q_UNUSED(timeoutMs);
+	*damage = QRect(QPoint(0, 0), geometry.size());
+	return this->getScreenshotImage(geometry);
 }
 
 void Platform::waylandFullscreen() {
 }
 
+bool parseRegion(const QString &str, QRect *out) {
+	auto parts = str.split(',');
+	if (parts.size() != 4) {
+		return false;
+	}
+
+	int v[4];
+	for (int i = 0; i < 4; i++) {
+		bool ok = false;
+		v[i] = parts[i].trimmed().toInt(&ok);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	*out = QRect(v[0], v[1], v[2], v[3]);
+	return !out->isEmpty();
+}
+
 QDebug operator<<(QDebug debug, const OpenWindow &win) {
 	QDebugStateSaver saver(debug);
 	debug.nospace() << "Win(" << win.name << win.geometry << ')';
@@ -10,6 +10,7 @@
 #include <QImage>
 #include <QObject>
 #include <QPixmap>
+#include <QRegion>
 
 struct OpenWindow {
  public:
@@ -18,6 +19,18 @@ struct OpenWindow {
 };
 QDebug operator<<(QDebug, const OpenWindow &);
 
+// Parses a region written as x,y,w,h, as the command line and capture socket take them. Returns
+// false unless it is well formed with a positive size.
+bool parseRegion(const QString &str, QRect *out);
+
+// One screen's part of a capture, in the screen's own resolution
+struct ScreenTile {
+ public:
+	// where the image goes, in the same coordinates as the captured geometry
+	QRect geometry;
+	QImage image;
+};
+
 class Platform : public QObject {
 	Q_OBJECT
 	Q_DISABLE_COPY(Platform)
@@ -34,8 +47,25 @@ class Platform : public QObject {
 	}
 
 	virtual QImage getCursorImage();
+	// Starts keeping the window list current, so captures don't have to read all of it. For
+	// instances that stay running; headless captures never call it.
+	virtual void trackOpenWindows();
+	// Starts getting the window list in the background, for backends that have to ask for it.
+	// Call it before a capture that will be followed by getOpenWindows.
+	virtual void prepareOpenWindows();
+	// windows that can be selected by clicking them, topmost first
 	virtual QList<OpenWindow> getOpenWindows();
-	virtual QPixmap getScreenshot(QRect geometry);
+	// Captures exactly geometry, in virtual desktop coordinates. Backends only grab the parts of the
+	// screens that geometry covers, so small captures cost in proportion to their size.
+	virtual QImage getScreenshotImage(QRect geometry);
+	QPixmap getScreenshot(QRect geometry);
+	// Captures geometry as one tile per screen it covers instead of one image of its bounding box,
+	// so space between offset or mismatched screens is never allocated.
+	virtual QList<ScreenTile> getScreenshotTiles(QRect geometry);
+	// Captures geometry for repeated grabs. damage receives the part of the returned image that
+	// changed since the last call; backends that can't tell report all of it. timeoutMs bounds how
+	// long to wait for something to change on backends that only deliver changed frames.
+	virtual QImage getScreenshotIncremental(QRect geometry, QRegion *damage, int timeoutMs);
 	virtual void waylandFullscreen();
 	virtual bool isWayland();
 };
@@ -0,0 +1,307 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "pngwriter.hxx"
+
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+
+// raw bytes each stripe covers. Every stripe starts with an empty window, so smaller stripes
+// cost compression; this keeps the loss well under a percent while a large capture still
+// splits into far more stripes than there are cores
+static const size_t STRIPE_BYTES = 1024 * 1024;
+// IDAT chunks are flushed at this size
+static const size_t IDAT_BYTES = 256 * 1024;
+
+enum Filter : uint8_t {
+	FILTER_NONE,
+	FILTER_SUB,
+	FILTER_UP,
+	FILTER_AVERAGE,
+	FILTER_PAETH,
+};
+
+struct Stripe {
+	int y0;
+	int y1;
+	std::vector<uint8_t> deflated;
+	uint32_t adler;
+	size_t rawLen;
+	bool ok;
+};
+
+static void putBE32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+// converts a row of ARGB32, ARGB32_Premultiplied or RGB32 pixels to R,G,B(,A) bytes
+static void convertRow(uint8_t *dst, const QRgb *src, int width, bool premultiplied, bool alpha) {
+	for (int x = 0; x < width; x++) {
+		QRgb p = premultiplied ? qUnpremultiply(src[x]) : src[x];
+		*dst++ = qRed(p);
+		*dst++ = qGreen(p);
+		*dst++ = qBlue(p);
+		if (alpha) {
+			*dst++ = qAlpha(p);
+		}
+	}
+}
+
+static inline uint8_t paeth(int a, int b, int c) {
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+// writes the filter byte and the filtered row to out
+static void filterRow(uint8_t *out, Filter filter, const uint8_t *cur, const uint8_t *prev, size_t len, int bpp) {
+	*out++ = filter;
+	switch (filter) {
+		case FILTER_NONE:
+			memcpy(out, cur, len);
+			break;
+		case FILTER_SUB:
+			memcpy(out, cur, bpp);
+			for (size_t i = bpp; i < len; i++) {
+				out[i] = cur[i] - cur[i - bpp];
+			}
+			break;
+		case FILTER_UP:
+			for (size_t i = 0; i < len; i++) {
+				out[i] = cur[i] - prev[i];
+			}
+			break;
+		case FILTER_AVERAGE:
+			for (size_t i = 0; i < (size_t)bpp; i++) {
+				out[i] = cur[i] - (prev[i] >> 1);
+			}
+			for (size_t i = bpp; i < len; i++) {
+				out[i] = cur[i] - ((cur[i - bpp] + prev[i]) >> 1);
+			}
+			break;
+		case FILTER_PAETH:
+			for (size_t i = 0; i < (size_t)bpp; i++) {
+				out[i] = cur[i] - prev[i];
+			}
+			for (size_t i = bpp; i < len; i++) {
+				out[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+			}
+			break;
+	}
+}
+
+// sum of the filtered bytes taken as signed, the usual estimate of how well a row compresses
+static size_t filterCost(const uint8_t *filtered, size_t len) {
+	size_t sum = 0;
+	for (size_t i = 0; i < len; i++) {
+		sum += abs((int8_t)filtered[i]);
+	}
+	return sum;
+}
+
+static void encodeStripe(Stripe *stripe, const QImage &image, int level, bool alpha, bool last) {
+	bool premultiplied = image.format() == QImage::Format_ARGB32_Premultiplied;
+	int bpp = alpha ? 4 : 3;
+	size_t rowBytes = (size_t)image.width() * bpp;
+	bool adaptive = level >= 4;
+
+	std::vector<uint8_t> prev(rowBytes, 0);
+	std::vector<uint8_t> cur(rowBytes);
+	std::vector<uint8_t> line(1 + rowBytes);
+	std::vector<uint8_t> candidate(adaptive ? 1 + rowBytes : 0);
+	if (stripe->y0 > 0) {
+		// filters look at the row above, which belongs to the previous stripe
+		convertRow(prev.data(), reinterpret_cast<const QRgb *>(image.constScanLine(stripe->y0 - 1)), image.width(), premultiplied, alpha);
+	}
+
+	// each stripe is raw deflate; the zlib header and checksum are written around the joined stream
+	z_stream zs{};
+	if (deflateInit2(&zs, level == 0 ? 1 : level, Z_DEFLATED, -15, 8, level == 0 ? Z_RLE : Z_DEFAULT_STRATEGY) != Z_OK) {
+		stripe->ok = false;
+		return;
+	}
+
+	stripe->rawLen = (size_t)(stripe->y1 - stripe->y0) * line.size();
+	stripe->deflated.resize(deflateBound(&zs, stripe->rawLen) + 64);
+	zs.next_out = stripe->deflated.data();
+	zs.avail_out = stripe->deflated.size();
+	stripe->adler = adler32(0, nullptr, 0);
+	stripe->ok = true;
+
+	auto pump = [&](int flush) {
+		for (;;) {
+			if (zs.avail_out == 0) {
+				size_t used = stripe->deflated.size();
+				stripe->deflated.resize(used * 2);
+				zs.next_out = stripe->deflated.data() + used;
+				zs.avail_out = stripe->deflated.size() - used;
+			}
+			int ret = deflate(&zs, flush);
+			if (ret == Z_STREAM_ERROR) {
+				return false;
+			}
+			if (flush == Z_FINISH ? ret == Z_STREAM_END : zs.avail_in == 0 && zs.avail_out != 0) {
+				return true;
+			}
+		}
+	};
+
+	for (int y = stripe->y0; stripe->ok && y < stripe->y1; y++) {
+		convertRow(cur.data(), reinterpret_cast<const QRgb *>(image.constScanLine(y)), image.width(), premultiplied, alpha);
+
+		if (adaptive) {
+			size_t best = SIZE_MAX;
+			for (Filter f : {FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH}) {
+				filterRow(candidate.data(), f, cur.data(), prev.data(), rowBytes, bpp);
+				size_t cost = filterCost(candidate.data() + 1, rowBytes);
+				if (cost < best) {
+					best = cost;
+					line.swap(candidate);
+				}
+			}
+		} else {
+			filterRow(line.data(), FILTER_SUB, cur.data(), prev.data(), rowBytes, bpp);
+		}
+
+		stripe->adler = adler32(stripe->adler, line.data(), line.size());
+		zs.next_in = line.data();
+		zs.avail_in = line.size();
+		stripe->ok = pump(Z_NO_FLUSH);
+		prev.swap(cur);
+	}
+
+	// a sync flush ends on a byte boundary without ending the stream, so the next stripe's
+	// blocks can follow it directly
+	stripe->ok = stripe->ok && pump(last ? Z_FINISH : Z_SYNC_FLUSH);
+	stripe->deflated.resize(stripe->deflated.size() - zs.avail_out);
+	deflateEnd(&zs);
+}
+
+static bool writeChunk(QIODevice *out, const char *type, const uint8_t *data, uint32_t len, QString *error) {
+	uint8_t head[8];
+	putBE32(head, len);
+	memcpy(head + 4, type, 4);
+	uint32_t crc = crc32(0, head + 4, 4);
+	if (len > 0) {
+		// zlib resets the crc when handed a null buffer
+		crc = crc32(crc, data, len);
+	}
+	uint8_t tail[4];
+	putBE32(tail, crc);
+	if (out->write(reinterpret_cast<const char *>(head), sizeof(head)) != sizeof(head)
+		|| out->write(reinterpret_cast<const char *>(data), len) != len
+		|| out->write(reinterpret_cast<const char *>(tail), sizeof(tail)) != sizeof(tail)) {
+		*error = out->errorString();
+		return false;
+	}
+	return true;
+}
+
+bool writePng(const QImage &input, QIODevice *out, int level, QString *error) {
+	if (input.isNull()) {
+		*error = "empty image";
+		return false;
+	}
+
+	level = qBound(0, level, 9);
+	bool alpha = input.hasAlphaChannel();
+	QImage image = input;
+	if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32 && image.format() != QImage::Format_ARGB32_Premultiplied) {
+		image = image.convertToFormat(alpha ? QImage::Format_ARGB32 : QImage::Format_RGB32);
+	}
+
+	static const uint8_t SIGNATURE[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	if (out->write(reinterpret_cast<const char *>(SIGNATURE), sizeof(SIGNATURE)) != sizeof(SIGNATURE)) {
+		*error = out->errorString();
+		return false;
+	}
+
+	uint8_t ihdr[13];
+	putBE32(ihdr, image.width());
+	putBE32(ihdr + 4, image.height());
+	ihdr[8] = 8;	// bit depth
+	ihdr[9] = alpha ? 6 : 2;	// truecolor, with or without alpha
+	ihdr[10] = 0;	// deflate
+	ihdr[11] = 0;	// adaptive filtering
+	ihdr[12] = 0;	// not interlaced
+	if (!writeChunk(out, "IHDR", ihdr, sizeof(ihdr), error)) {
+		return false;
+	}
+
+	size_t rowBytes = 1 + (size_t)image.width() * (alpha ? 4 : 3);
+	int stripeRows = qMax<int>(1, STRIPE_BYTES / rowBytes);
+	std::vector<Stripe> stripes;
+	for (int y = 0; y < image.height(); y += stripeRows) {
+		stripes.push_back(Stripe{y, qMin(y + stripeRows, image.height()), {}, 0, 0, false});
+	}
+
+	std::atomic<size_t> next = 0;
+	auto work = [&]() {
+		for (size_t i; (i = next.fetch_add(1)) < stripes.size();) {
+			encodeStripe(&stripes[i], image, level, alpha, i == stripes.size() - 1);
+		}
+	};
+
+	// Helpers only run on threads that are free right now; queueing them could deadlock when every
+	// pool thread is itself waiting in here. This thread takes stripes too, so a busy pool only
+	// costs parallelism.
+	int wanted = qMin<int>(QThread::idealThreadCount() - 1, stripes.size() - 1);
+	int helpers = 0;
+	QSemaphore done;
+	for (int i = 0; i < wanted; i++) {
+		bool started = QThreadPool::globalInstance()->tryStart([&]() {
+			work();
+			done.release();
+		});
+		if (!started) {
+			break;
+		}
+		helpers++;
+	}
+	work();
+	done.acquire(helpers);
+
+	std::vector<uint8_t> idat;
+	idat.reserve(IDAT_BYTES * 2);
+	// zlib header: 32k window, deflate, with the level hint matching what was used
+	static const uint8_t FLEVEL[] = {0x01, 0x01, 0x5E, 0x5E, 0x5E, 0x5E, 0x9C, 0xDA, 0xDA, 0xDA};
+	idat.push_back(0x78);
+	idat.push_back(FLEVEL[level]);
+
+	uint32_t adler = adler32(0, nullptr, 0);
+	for (auto &stripe : stripes) {
+		if (!stripe.ok) {
+			*error = "unable to deflate image";
+			return false;
+		}
+		adler = adler32_combine(adler, stripe.adler, stripe.rawLen);
+
+		idat.insert(idat.end(), stripe.deflated.begin(), stripe.deflated.end());
+		std::vector<uint8_t>().swap(stripe.deflated);
+		if (idat.size() >= IDAT_BYTES) {
+			if (!writeChunk(out, "IDAT", idat.data(), idat.size(), error)) {
+				return false;
+			}
+			idat.clear();
+		}
+	}
+
+	uint8_t trailer[4];
+	putBE32(trailer, adler);
+	idat.insert(idat.end(), trailer, trailer + sizeof(trailer));
+	return writeChunk(out, "IDAT", idat.data(), idat.size(), error)
+		&& writeChunk(out, "IEND", nullptr, 0, error);
+}
@@ -0,0 +1,18 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef PNGWRITER_HXX
+#define PNGWRITER_HXX
+
+#include <QIODevice>
+#include <QImage>
+
+// Writes image as a PNG. The image is cut into horizontal stripes which are converted, filtered
+// and deflated on the global thread pool, each as its own run of deflate blocks, and joined into
+// a single zlib stream like pigz does.
+//
+// level 0 uses the sub filter and run length matching only. 1-3 use the sub filter at that zlib
+// level, 4-9 pick a filter per row and use that zlib level.
+bool writePng(const QImage &image, QIODevice *out, int level, QString *error);
+
+#endif	// PNGWRITER_HXX
@@ -9,6 +9,7 @@
 #include <QClipboard>
 #include <QDateTime>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QGraphicsPixmapItem>
 #include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
@@ -24,39 +25,33 @@
 #include <QScreen>
 #include <QShortcut>
 #include <QStandardPaths>
+#include <QStyleOptionGraphicsItem>
 
 #include "config.hxx"
 #include "confirmdialog.hxx"
+#include "encodequeue.hxx"
 #include "platform.hxx"
+#include "trace.hxx"
 
 // #define NO_FULLSCREEN
 
+SelectionWindow *SelectionWindow::prewarmed = nullptr;
+bool SelectionWindow::prewarmEnabled = false;
+
 SelectionWindow::SelectionWindow(QWidget *parent)
 	: QWidget(parent),
 		picking(false),
 		pickedLock(false),
+		pickPending(false),
 		recursingGeometry(-1),
-		openWindows(),
+		hoveredWindow(-1),
 		selectionStart(),
 		selectionEnd(),
 		selection(),
-		shot(),
-		cursor() {
-	this->cursorPosition = QCursor::pos();
-	QScreen *screen = QGuiApplication::screenAt(this->cursorPosition);
-	if (screen == nullptr) {
-		screen = QGuiApplication::primaryScreen();
-	}
-	this->desktopGeometry = screen->virtualGeometry();
-
-	this->shot = platform->getScreenshot(this->desktopGeometry);
-
-	auto cursorImage = platform->getCursorImage();
-	this->cursor = QPixmap::fromImage(cursorImage);
-	this->cursorPosition -= cursorImage.offset();
-
-	this->openWindows = platform->getOpenWindows();
-
+		awaitingFirstFrame(false),
+		lastFrameSwap(0),
+		cursor(),
+		activeDrawing(nullptr) {
 #ifndef NO_FULLSCREEN
 	if (platform->isWayland()) {
 		this->setWindowFlags(Qt::FramelessWindowHint);
@@ -71,7 +66,24 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 	this->scene = new QGraphicsScene(this);
 
 	this->selectionView = new QGraphicsView(this);
-	this->selectionView->setViewport(new QOpenGLWidget(this->selectionView));
+	auto *viewport = new QOpenGLWidget(this->selectionView);
+	// keep the last frame around so a moving selection only redraws what it uncovered
+	viewport->setUpdateBehavior(QOpenGLWidget::PartialUpdate);
+	connect(viewport, &QOpenGLWidget::frameSwapped, this, [this]() {
+		if (this->awaitingFirstFrame) {
+			this->awaitingFirstFrame = false;
+			Trace::instant("first frame");
+		}
+		if (Trace::enabled()) {
+			qint64 now = Trace::now();
+			// a gap this long was idle, not a slow frame
+			if (this->lastFrameSwap != 0 && now - this->lastFrameSwap < 1000000) {
+				Trace::counter("frame time ms", (now - this->lastFrameSwap) / 1000.0);
+			}
+			this->lastFrameSwap = now;
+		}
+	});
+	this->selectionView->setViewport(viewport);
 	this->selectionView->setScene(this->scene);
 	this->selectionView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
 	this->selectionView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
@@ -79,11 +91,14 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 
 	this->shotItem = new ShotItem(this);
 	this->scene->addItem(this->shotItem);
-	this->shotItem->setOffset(0, 0);
 	this->cursorItem = this->scene->addPixmap(this->cursor);
-	this->cursorItem->setOffset(this->cursorPosition);
-	this->selectionItem = this->scene->addPath(QPainterPath(), QPen(), QColor(0, 0, 0, 175));
-	this->selectionItem->setPos(0, 0);
+	this->selectionItem = new DimOverlayItem(QColor(0, 0, 0, 175));
+	this->scene->addItem(this->selectionItem);
+	QPen hoverPen(this->palette().color(QPalette::Highlight), 2);
+	hoverPen.setCosmetic(true);
+	this->hoverItem = this->scene->addRect(QRectF(), hoverPen);
+	this->hoverItem->setAcceptedMouseButtons(Qt::NoButton);
+	this->hoverItem->setVisible(false);
 
 	this->shotToolbar = new QToolBar(this);
 	this->shotToolbar->setAutoFillBackground(true);
@@ -92,16 +107,6 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 	this->pickToolbar->setAutoFillBackground(true);
 	this->pickToolbar->setHidden(true);
 
-	{
-		QRect geo = screen->geometry();
-		QPoint pt(
-			qBound(geo.left(), geo.center().x() - (shotToolbar->width() / 2), geo.right()),
-			geo.top() + 40);
-
-		this->shotToolbar->move(pt);
-		this->pickToolbar->move(pt);
-	}
-
 	this->shotToolbar->addWidget(new DragHandle(this->shotToolbar));
 	this->pickToolbar->addWidget(new DragHandle(this->pickToolbar));
 
@@ -161,27 +166,45 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 				qAction->setShortcuts(Config::parseHotkeys((*tab)["key"]));
 
 				std::function<void()> doAction{};
+				SaveFormat format = SaveFormat::fromConfig(tab);
 
 				if (*action == "copy") {
-					doAction = [this]() {
+					doAction = [this, format]() {
 						this->close();
-						auto pixmap = this->pixmap();
-						pixmap.save(this->savePath());
+						auto image = this->image();
 						auto *clipboard = QGuiApplication::clipboard();
-						clipboard->setPixmap(pixmap);
+						clipboard->setImage(image);
+						EncodeQueue::instance()->save(image, this->savePath(format), format);
 					};
 				} else if (*action == "save-default") {
-					doAction = [this]() {
+					doAction = [this, format]() {
 						this->close();
-						this->saveTo(this->savePath());
+						this->saveTo(this->savePath(format), format);
 					};
 				} else if (*action == "save-as") {
-					doAction = [this]() {
+					doAction = [this, format]() {
 						this->hide();
-						auto filename = QFileDialog::getSaveFileName(this, "Save screenshot", this->savePath(), "*.png");
+						QStringList filters;
+						QString selected;
+						for (auto *enc : Encoder::available()) {
+							filters.append(QString("%1 (*.%2)").arg(QLatin1StringView(enc->description()), QLatin1StringView(enc->suffix())));
+							if (enc == format.encoder) {
+								selected = filters.last();
+							}
+						}
+						auto filename = QFileDialog::getSaveFileName(this, "Save screenshot", this->savePath(format), filters.join(";;"), &selected);
 						if (!filename.isEmpty()) {
+							// the filter picks between encoders sharing a suffix, the filename between the rest
+							SaveFormat chosen = format;
+							int filter = filters.indexOf(selected);
+							if (filter >= 0) {
+								chosen.encoder = Encoder::available()[filter];
+							}
+							if (QFileInfo(filename).suffix().isEmpty()) {
+								filename += QString(".") + chosen.encoder->suffix();
+							}
 							this->close();
-							this->saveTo(filename);
+							this->saveTo(filename, chosen.forPath(filename));
 						} else {
 							this->show();
 						}
@@ -210,16 +233,20 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 					}
 					QString process = args.takeFirst();
 					args.append("");
-					doAction = [this, process, args]() mutable {
+					doAction = [this, process, args, format]() mutable {
 						this->close();
-						QString path = this->savePath();
-						this->saveTo(path);
+						QString path = this->savePath(format);
 						args[args.size() - 1] = path;
-						auto *proc = new QProcess();
-						proc->setProcessChannelMode(QProcess::ForwardedChannels);
-						proc->start(process, args);
-						connect(proc, &QProcess::finished, proc, [proc](int, QProcess::ExitStatus) {
-							proc->deleteLater();
+						this->saveTo(path, format, [process, args](bool ok) {
+							if (!ok) {
+								return;
+							}
+							auto *proc = new QProcess();
+							proc->setProcessChannelMode(QProcess::ForwardedChannels);
+							proc->start(process, args);
+							connect(proc, &QProcess::finished, proc, [proc](int, QProcess::ExitStatus) {
+								proc->deleteLater();
+							});
 						});
 					};
 				} else {
@@ -228,12 +255,17 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 					continue;
 				}
 
+				doAction = [doAction, traceName = QString::fromStdString(*action)]() {
+					TraceSpan span("action", traceName);
+					doAction();
+				};
+
 				auto confirm = Config::get<std::string>(tab, "confirm", "confirm must be a string", "");
 				if (!confirm.has_value() || confirm->empty()) {
 					connect(qAction, &QAction::triggered, this, doAction);
 				} else {
 					connect(qAction, &QAction::triggered, this, [this, confirm, doAction]() {
-						auto qv = new ConfirmDialog(this->pixmap(), QString::fromStdString(*confirm),
+						auto qv = new ConfirmDialog(QPixmap::fromImage(this->image()), QString::fromStdString(*confirm),
 							platform->isWayland() ? this : nullptr);
 						connect(qv, &ConfirmDialog::accepted, this, doAction);
 						connect(qv, &ConfirmDialog::rejected, this, &SelectionWindow::show);
@@ -294,8 +326,26 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 	this->pickToolbar->addAction(close);
 
 	this->pickTooltip = new ZoomTooltip(this);
+	this->pickRadius = 7;
+	this->pickAverage = 1;
+	if (auto pickerTab = Config::get<toml::table>(&config->root, "picker", "picker should be a table")) {
+		this->pickRadius = qBound<int64_t>(1, Config::get<int64_t>(&*pickerTab, "radius", "radius should be an integer").value_or(7), 64);
+		this->pickAverage = qBound<int64_t>(1, Config::get<int64_t>(&*pickerTab, "average", "average should be an integer").value_or(1), 2 * this->pickRadius + 1);
+		this->pickTooltip->setScale(qBound<int64_t>(1, Config::get<int64_t>(&*pickerTab, "zoom", "zoom should be an integer").value_or(8), 32));
+	}
+
+	this->pickTimer = new QTimer(this);
+	this->pickTimer->setSingleShot(true);
+	this->pickTimer->setTimerType(Qt::PreciseTimer);
+	connect(this->pickTimer, &QTimer::timeout, this, [this]() {
+		if (this->pickPending) {
+			this->queuePickMoved();
+		}
+	});
 
 	this->undoStack = new QUndoStack(this);
+	// undoing then drawing again can land on the same index, so drop the export on any change
+	QObject::connect(this->undoStack, &QUndoStack::indexChanged, this, [this]() { this->exportCache = QImage(); });
 
 	{
 		auto undo = this->undoStack->createUndoAction(this);
@@ -307,6 +357,106 @@ SelectionWindow::SelectionWindow(QWidget *parent)
 		this->addAction(redo);
 	}
 
+}
+
+SelectionWindow *SelectionWindow::capture() {
+	SelectionWindow *win = SelectionWindow::prewarmed;
+	SelectionWindow::prewarmed = nullptr;
+	if (win == nullptr) {
+		TraceSpan span("construct window");
+		win = new SelectionWindow();
+	}
+
+	win->takeScreenshot();
+
+	if (SelectionWindow::prewarmEnabled) {
+		// build the replacement once this one is gone so it doesn't compete with the overlay for frame time
+		connect(win, &QObject::destroyed, []() {
+			QTimer::singleShot(0, &SelectionWindow::prewarm);
+		});
+	}
+
+	return win;
+}
+
+void SelectionWindow::enablePrewarm() {
+	SelectionWindow::prewarmEnabled = true;
+	QTimer::singleShot(0, &SelectionWindow::prewarm);
+}
+
+void SelectionWindow::prewarm() {
+	if (SelectionWindow::prewarmed != nullptr) {
+		return;
+	}
+
+	SelectionWindow::prewarmed = new SelectionWindow();
+	platform->trackOpenWindows();
+}
+
+void SelectionWindow::takeScreenshot() {
+	TraceSpan span("take screenshot");
+	this->awaitingFirstFrame = true;
+
+	this->cursorPosition = QCursor::pos();
+	QScreen *screen = QGuiApplication::screenAt(this->cursorPosition);
+	if (screen == nullptr) {
+		screen = QGuiApplication::primaryScreen();
+	}
+	this->desktopGeometry = screen->virtualGeometry();
+
+	platform->prepareOpenWindows();
+	QList<ScreenTile> tiles;
+	{
+		TraceSpan span("platform capture");
+		tiles = platform->getScreenshotTiles(this->desktopGeometry);
+	}
+	{
+		TraceSpan span("upload");
+		this->shotTiles.clear();
+		for (ScreenTile &tile : tiles) {
+			QPixmap pixmap = QPixmap::fromImage(tile.image);
+			this->shotTiles.push_back(ShotTile{
+				tile.geometry.translated(-this->desktopGeometry.topLeft()),
+				std::move(tile.image),
+				std::move(pixmap),
+			});
+		}
+		this->shotItem->setBounds(QRect(QPoint(0, 0), this->desktopGeometry.size()));
+		this->shotItem->update();
+	}
+	this->exportCache = QImage();
+
+	QImage cursorImage;
+	{
+		TraceSpan span("cursor");
+		cursorImage = platform->getCursorImage();
+	}
+	this->cursor = QPixmap::fromImage(cursorImage);
+	this->cursorPosition -= cursorImage.offset();
+	this->cursorItem->setPixmap(this->cursor);
+	this->cursorItem->setOffset(this->cursorPosition);
+
+	{
+		TraceSpan span("window list");
+		QList<OpenWindow> windows = platform->getOpenWindows();
+		for (OpenWindow &w : windows) {
+			w.geometry.translate(-this->desktopGeometry.topLeft());
+		}
+		this->windowIndex.rebuild(std::move(windows), QRect(QPoint(0, 0), this->desktopGeometry.size()));
+		this->hoverWindow(-1);
+	}
+
+	{
+		QRect geo = screen->geometry();
+		QPoint pt(
+			qBound(geo.left(), geo.center().x() - (shotToolbar->width() / 2), geo.right()),
+			geo.top() + 40);
+
+		this->shotToolbar->move(pt);
+		this->pickToolbar->move(pt);
+	}
+
+	this->selectionItem->setBounds(QRect(QPoint(0, 0), this->desktopGeometry.size()));
 	this->selectionMoved();
 
 	this->recursingGeometry = 0;
@@ -325,6 +475,7 @@ void SelectionWindow::setPicking(bool picking) {
 	this->pickToolbar->setVisible(picking);
 	this->shotToolbar->setVisible(!picking);
 	this->pickTooltip->setVisible(picking);
+	this->hoverWindow(-1);
 	if (picking) {
 		this->pickToolbar->move(this->shotToolbar->pos());
 		this->cursorItem->setVisible(false);
@@ -352,31 +503,65 @@ bool SelectionWindow::event(QEvent *event) {
 	return QWidget::event(event);
 }
 
-QPixmap SelectionWindow::pixmap() {
+static void releaseSharedImage(void *image) {
+	delete reinterpret_cast<QImage *>(image);
+}
+
+QImage SelectionWindow::image() {
 	QRect selection = this->selection;
 	if (selection.isEmpty()) {
-		selection = this->desktopGeometry;
+		selection = QRect(QPoint(0, 0), this->desktopGeometry.size());
 	}
 
-	this->selectionItem->setVisible(false);
-
-	QPixmap pixmap(selection.size());
-	QPainter painter(&pixmap);
-	this->scene->render(&painter, pixmap.rect(), selection);
+	bool withCursor = this->cursorItem->isVisible() && this->cursorItem->sceneBoundingRect().intersects(selection);
+	int undoIndex = this->undoStack->index();
+	if (!this->exportCache.isNull()
+		&& this->exportCacheRect == selection
+		&& this->exportCacheCursor == withCursor) {
+		return this->exportCache;
+	}
 
-	this->selectionItem->setVisible(true);
+	QImage out;
+	const ShotTile *tile = this->tileAt(selection.topLeft());
+	if (undoIndex == 0 && !withCursor && this->tileCovers(tile, selection) && tile->image.devicePixelRatio() == 1) {
+		// nothing is drawn over the shot, so hand out a view of it rather than rasterizing the scene
+		const QImage &img = tile->image;
+		QPoint crop = selection.topLeft() - tile->geometry.topLeft();
+		const uchar *bits = img.constBits()
+			+ crop.y() * img.bytesPerLine()
+			+ crop.x() * (img.depth() / 8);
+		out = QImage(bits, selection.width(), selection.height(), img.bytesPerLine(), img.format(),
+			&releaseSharedImage, new QImage(img));
+	} else {
+		// the shot only draws the tiles the selection touches
+		bool hovering = this->hoverItem->isVisible();
+		this->selectionItem->setVisible(false);
+		this->hoverItem->setVisible(false);
+
+		out = QImage(selection.size(), QImage::Format_ARGB32_Premultiplied);
+		out.fill(Qt::transparent);
+		QPainter painter(&out);
+		this->scene->render(&painter, out.rect(), selection);
+		painter.end();
+
+		this->selectionItem->setVisible(true);
+		this->hoverItem->setVisible(hovering);
+	}
 
-	return pixmap;
+	this->exportCache = out;
+	this->exportCacheRect = selection;
+	this->exportCacheCursor = withCursor;
+	return out;
 }
-void SelectionWindow::saveTo(QString path) {
-	this->pixmap().save(path);
+void SelectionWindow::saveTo(QString path, SaveFormat format, std::function<void(bool)> done) {
+	EncodeQueue::instance()->save(this->image(), path, format, std::move(done));
 }
-QString SelectionWindow::savePath() {
+QString SelectionWindow::savePath(const SaveFormat &format) {
 	QDateTime now = QDateTime::currentDateTime();
 	QString month = now.toString("yyyy-MM");
 	QDir monthDir(QStandardPaths::writableLocation(QStandardPaths::HomeLocation) + "/screenshots/" + month + "/");
 	monthDir.mkpath(".");
-	QString path = monthDir.filePath(now.toString("yyyy-MM-dd_hh-mm-ss") + ".png");
+	QString path = monthDir.filePath(now.toString("yyyy-MM-dd_hh-mm-ss") + "." + format.encoder->suffix());
 	return path;
 }
 
@@ -408,40 +593,135 @@ void SelectionWindow::geometryChanged(QEvent *) {
 }
 
 void SelectionWindow::selectionMoved() {
-	QPainterPath path;
-	path.addRect(this->desktopGeometry);
 	if (!this->selectionStart.isNull() && !this->selectionEnd.isNull()) {
 		QRect sel(this->selectionStart, this->selectionEnd);
 		this->selection = sel.normalized();
-
-		QPainterPath selection;
-		selection.addRect(this->selection);
-
-		path -= selection;
 	} else {
 		this->selection = QRect();
 	}
 
-	this->selectionItem->setPath(path);
+	this->selectionItem->setHole(this->selection);
+}
+
+void SelectionWindow::hoverWindow(int window) {
+	if (this->hoveredWindow == window) {
+		// hover events come at the mouse's rate, so only touch the scene when the target changes
+		return;
+	}
+	this->hoveredWindow = window;
+	if (window < 0) {
+		this->hoverItem->setVisible(false);
+		return;
+	}
+	this->hoverItem->setRect(this->windowIndex.at(window).geometry);
+	this->hoverItem->setVisible(true);
+}
+
+void SelectionWindow::selectWindow(int window) {
+	if (window < 0) {
+		return;
+	}
+	const QRect &geometry = this->windowIndex.at(window).geometry;
+	this->selectionStart = geometry.topLeft();
+	this->selectionEnd = geometry.bottomRight();
+	this->selectionMoved();
+}
+
+void SelectionWindow::queuePickMoved() {
+	if (this->pickTimer->isActive()) {
+		this->pickPending = true;
+		return;
+	}
+
+	// the first move goes out straight away; any more until the next frame are folded into one
+	this->pickPending = false;
+	this->pickMoved();
+	qreal hz = this->screen() ? this->screen()->refreshRate() : 60;
+	this->pickTimer->start(qMax(1, int(1000 / qMax<qreal>(hz, 1))));
+}
+
+const SelectionWindow::ShotTile *SelectionWindow::tileAt(QPoint pos) const {
+	// scaled outputs can overlap; later tiles are painted over earlier ones, so they win
+	for (qsizetype i = this->shotTiles.size() - 1; i >= 0; i--) {
+		if (this->shotTiles[i].geometry.contains(pos)) {
+			return &this->shotTiles[i];
+		}
+	}
+	return nullptr;
+}
+
+bool SelectionWindow::tileCovers(const ShotTile *tile, QRect rect) const {
+	if (tile == nullptr || !tile->geometry.contains(rect)) {
+		return false;
+	}
+	for (const ShotTile &other : this->shotTiles) {
+		if (&other != tile && other.geometry.intersects(rect)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+QImage SelectionWindow::shotRegion(QRect rect) const {
+	const ShotTile *tile = this->tileAt(rect.topLeft());
+	if (this->tileCovers(tile, rect)) {
+		return tile->image.copy(rect.translated(-tile->geometry.topLeft()));
+	}
+
+	QImage out(rect.size(), QImage::Format_ARGB32_Premultiplied);
+	out.fill(Qt::transparent);
+	QPainter painter(&out);
+	for (const ShotTile &tile : this->shotTiles) {
+		QRect part = tile.geometry.intersected(rect);
+		if (!part.isEmpty()) {
+			painter.drawImage(part.topLeft() - rect.topLeft(), tile.image, part.translated(-tile.geometry.topLeft()));
+		}
+	}
+	return out;
+}
+
+QColor SelectionWindow::sampleColor(QPoint pos) const {
+	const ShotTile *tile = this->tileAt(pos);
+	if (!tile) {
+		return QColor();
+	}
+	// averaging stays within the screen under pos
+	const QImage &img = tile->image;
+	QRect area = QRect(pos - tile->geometry.topLeft() - QPoint(this->pickAverage / 2, this->pickAverage / 2), QSize(this->pickAverage, this->pickAverage))
+		.intersected(img.rect());
+	if (area.isEmpty()) {
+		return QColor();
+	}
+	if (area.width() == 1 && area.height() == 1) {
+		return img.pixelColor(area.topLeft());
+	}
+
+	int r = 0, g = 0, b = 0;
+	for (int y = area.top(); y <= area.bottom(); y++) {
+		for (int x = area.left(); x <= area.right(); x++) {
+			QRgb px = img.pixel(x, y);
+			r += qRed(px);
+			g += qGreen(px);
+			b += qBlue(px);
+		}
+	}
+	int n = area.width() * area.height();
+	return QColor((r + n / 2) / n, (g + n / 2) / n, (b + n / 2) / n);
 }
 
 void SelectionWindow::pickMoved() {
-	int radius = 7;
+	int radius = this->pickRadius;
 	int dia = radius * 2 + 1;
-	QPixmap subPx = this->shot.copy(QRect(this->pickPos - QPoint(radius, radius), QSize(dia, dia)));
-	QImage subIm = subPx.toImage();
+	// the capture is already in memory, so this never reads back from the GPU
+	QImage sub = this->shotRegion(QRect(this->pickPos - QPoint(radius, radius), QSize(dia, dia)));
 
-	QColor col = subIm.pixel(radius, radius);
-	emit this->pickColorChanged(col);
+	emit this->pickColorChanged(this->sampleColor(this->pickPos));
 
 	this->pickTooltip->move(this->pickPos + QPoint(5, 5));
-	this->pickTooltip->setImage(subPx);
+	this->pickTooltip->setImage(sub);
 }
 void SelectionWindow::pickSelected() {
-	QPixmap onePx = this->shot.copy(QRect(this->pickPos, QSize(1, 1)));
-	QImage oneIm = onePx.toImage();
-	QColor col = oneIm.pixel(0, 0);
-	emit this->pickColorSelected(col);
+	emit this->pickColorSelected(this->sampleColor(this->pickPos));
 	this->close();
 }
 
@@ -550,7 +830,7 @@ void ZoomTooltip::paintEvent(QPaintEvent *ev) {
 
 	QSize imSize = this->img.size();
 	QRect imBounds(QPoint(1, 1), imSize * this->scale);
-	p.drawPixmap(imBounds, this->img, this->img.rect());
+	p.drawImage(imBounds, this->img, this->img.rect());
 
 	p.setPen(Qt::black);
 	int w = imSize.width() * this->scale + 2;
@@ -574,7 +854,7 @@ void ZoomTooltip::paintEvent(QPaintEvent *ev) {
 		}
 	}
 }
-void ZoomTooltip::setImage(QPixmap image) {
+void ZoomTooltip::setImage(QImage image) {
 	this->img = image;
 	this->doResize();
 	this->update();
@@ -590,11 +870,28 @@ void ZoomTooltip::doResize() {
 	resize(this->img.size() * this->scale + QSize(1, 1));
 }
 
-ShotItem::ShotItem(SelectionWindow *parent) : QGraphicsPixmapItem(parent->shot), win(parent) {
+ShotItem::ShotItem(SelectionWindow *parent) : win(parent), bounds() {
+	this->setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
 	this->setAcceptHoverEvents(true);
 	this->setCursor(QCursor(Qt::CursorShape::CrossCursor));
 }
 ShotItem::~ShotItem() {}
+void ShotItem::setBounds(QRect bounds) {
+	if (this->bounds != bounds) {
+		this->prepareGeometryChange();
+		this->bounds = bounds;
+	}
+}
+QRectF ShotItem::boundingRect() const {
+	return this->bounds;
+}
+void ShotItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+	for (const SelectionWindow::ShotTile &tile : std::as_const(win->shotTiles)) {
+		if (tile.geometry.intersects(option->exposedRect.toAlignedRect())) {
+			painter->drawPixmap(tile.geometry.topLeft(), tile.pixmap);
+		}
+	}
+}
 void ShotItem::mousePressEvent(QGraphicsSceneMouseEvent *event) {
 	if (win->picking) {
 		if (event->buttons().testFlag(Qt::MiddleButton)) {
@@ -606,6 +903,7 @@ void ShotItem::mousePressEvent(QGraphicsSceneMouseEvent *event) {
 			win->pickSelected();
 		}
 	} else if (win->selectArea->isChecked()) {
+		win->hoverWindow(-1);
 		win->selectionStart = event->scenePos().toPoint();
 		win->selectionEnd = QPoint();
 		win->selectionMoved();
@@ -613,7 +911,7 @@ void ShotItem::mousePressEvent(QGraphicsSceneMouseEvent *event) {
 		auto penTab = Config::get<toml::table>(&config->root, "pen", "missing pen table");
 		if (penTab) {
 			QColor color(Config::get<int64_t>(&*penTab, "color", "color should be an integer").value_or(0xFF0000));
-			qreal width = Config::get<qreal>(&*penTab, "width", "width should be a number").value_or(4);
+			qreal width = Config::get<qreal>(&*penTab, "thickness", "thickness should be a number").value_or(4);
 			win->activeDrawing = new PenDrawing(QPen(QBrush(color), width), event->scenePos().toPoint());
 			win->scene->addItem(win->activeDrawing);
 		}
@@ -623,7 +921,7 @@ void ShotItem::mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
 	if (win->picking) {
 		if (event->buttons().testFlag(Qt::MiddleButton)) {
 			win->pickPos = event->scenePos().toPoint();
-			win->pickMoved();
+			win->queuePickMoved();
 		}
 	} else if (win->selectArea->isChecked()) {
 		if (event->buttons().testFlag(Qt::LeftButton)) {
@@ -637,8 +935,16 @@ void ShotItem::mouseMoveEvent(QGraphicsSceneMouseEvent *event) {
 	}
 }
 void ShotItem::mouseReleaseEvent(QGraphicsSceneMouseEvent *event) {
-	if (!win->picking && win->penTool->isChecked()) {
+	if (!win->picking && win->selectArea->isChecked()) {
+		QPoint pos = event->scenePos().toPoint();
+		if (win->selectionEnd.isNull()) {
+			// a click without a drag picks the window under it
+			win->selectWindow(win->windowIndex.find(pos));
+		}
+		win->hoverWindow(win->windowIndex.find(pos));
+	} else if (!win->picking && win->penTool->isChecked()) {
 		if (win->activeDrawing) {
+			win->activeDrawing->finish();
 			win->undoStack->push(new DrawingUndoItem(win, win->activeDrawing));
 			win->activeDrawing = nullptr;
 		}
@@ -648,33 +954,105 @@ void ShotItem::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event) {
 	if (win->picking || !win->selectArea->isChecked()) {
 		return;
 	}
-	QPoint pos = event->pos().toPoint();
-	auto *win = this->win;
-	for (const OpenWindow &w : std::as_const(win->openWindows)) {
-		if (w.geometry.contains(pos)) {
-			win->selectionStart = w.geometry.topLeft();
-			win->selectionEnd = w.geometry.bottomRight();
-			win->selectionMoved();
-			return;
-		}
-	}
+	win->selectWindow(win->windowIndex.find(event->scenePos().toPoint()));
 }
 void ShotItem::hoverMoveEvent(QGraphicsSceneHoverEvent *event) {
 	if (win->picking) {
 		if (!win->pickedLock) {
 			win->pickPos = event->scenePos().toPoint();
-			win->pickMoved();
+			win->queuePickMoved();
+		}
+	} else if (win->selectArea->isChecked()) {
+		win->hoverWindow(win->windowIndex.find(event->scenePos().toPoint()));
+	} else {
+		win->hoverWindow(-1);
+	}
+}
+void ShotItem::hoverLeaveEvent(QGraphicsSceneHoverEvent *event) {
+	win->hoverWindow(-1);
+}
+
+DimOverlayItem::DimOverlayItem(QColor color)
+	: bounds(),
+		hole(),
+		color(color) {
+	this->setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+	this->setAcceptedMouseButtons(Qt::NoButton);
+}
+DimOverlayItem::~DimOverlayItem() {
+}
+QRectF DimOverlayItem::boundingRect() const {
+	return this->bounds;
+}
+void DimOverlayItem::setBounds(QRect bounds) {
+	if (this->bounds != bounds) {
+		this->prepareGeometryChange();
+		this->bounds = bounds;
+	}
+}
+// the area covered by the outline drawn around r
+static QRegion holeOutline(const QRect &r) {
+	if (r.isEmpty()) {
+		return {};
+	}
+	return QRegion(r.adjusted(-1, -1, 1, 1)) - QRegion(r.adjusted(1, 1, -1, -1));
+}
+void DimOverlayItem::setHole(QRect hole) {
+	if (this->hole == hole) {
+		return;
+	}
+
+	// what changed between the holes, plus both outlines since one may sit inside the other hole
+	QRegion dirty = QRegion(this->hole).xored(QRegion(hole)) + holeOutline(this->hole) + holeOutline(hole);
+	this->hole = hole;
+	for (const QRect &r : dirty) {
+		this->update(r);
+	}
+}
+void DimOverlayItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+	QRectF exposed = option->exposedRect;
+	QRectF b = this->bounds;
+	QRectF h = this->hole.intersected(this->bounds);
+	if (h.isEmpty()) {
+		painter->fillRect(b.intersected(exposed), this->color);
+		return;
+	}
+
+	const QRectF strips[] = {
+		QRectF(b.left(), b.top(), b.width(), h.top() - b.top()),
+		QRectF(b.left(), h.bottom(), b.width(), b.bottom() - h.bottom()),
+		QRectF(b.left(), h.top(), h.left() - b.left(), h.height()),
+		QRectF(h.right(), h.top(), b.right() - h.right(), h.height()),
+	};
+	for (const QRectF &strip : strips) {
+		QRectF visible = strip.intersected(exposed);
+		if (!visible.isEmpty()) {
+			painter->fillRect(visible, this->color);
 		}
 	}
+
+	painter->setPen(QPen(Qt::black, 0));
+	painter->setBrush(Qt::NoBrush);
+	painter->drawRect(h);
 }
 
+// how far each input point pulls the stroke towards it
+static const qreal PEN_SMOOTHING = 0.5;
+// points closer than this many pen widths to the last kept one are dropped
+static const qreal PEN_MIN_STEP = 0.25;
+// the tail is stroked and kept once it has this many points
+static const int PEN_CHUNK_POINTS = 64;
+// the bounding rect grows in steps of this much so the scene index isn't redone every point
+static const qreal PEN_BOUNDS_SLACK = 64;
+
 PenDrawing::PenDrawing(QPen pen, QPoint start)
-	: rawPath(),
-		bounds(start.x() - pen.widthF(), start.y() - pen.widthF(), pen.widthF() * 2, pen.widthF() * 2),
-		strokedPath() {
+	: smoothed(start),
+		lastInput(start),
+		bounds(start.x() - pen.widthF(), start.y() - pen.widthF(), pen.widthF() * 2, pen.widthF() * 2) {
 	setPen(pen);
-	this->rawPath.moveTo(start.x() - 1, start.y() - 1);
-	this->rawPath.lineTo(start);
+	setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+	// a zero length stroke has no caps, so a click still leaves a dot
+	this->tail << QPointF(start.x() - 1, start.y() - 1) << QPointF(start);
 }
 PenDrawing::~PenDrawing() {
 }
@@ -682,24 +1060,82 @@ QRectF PenDrawing::boundingRect() const {
 	return this->bounds;
 }
 void PenDrawing::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
-	this->updateStrokedPath();
-	painter->fillPath(this->strokedPath, this->pen().brush());
+	QBrush brush = this->pen().brush();
+	for (const Chunk &chunk : std::as_const(this->chunks)) {
+		if (chunk.bounds.intersects(option->exposedRect)) {
+			painter->fillPath(chunk.stroke, brush);
+		}
+	}
+	if (this->tailStroke.isEmpty()) {
+		this->tailStroke = this->stroke(this->tail);
+	}
+	painter->fillPath(this->tailStroke, brush);
 }
 void PenDrawing::addPoint(QPoint pt) {
-	this->prepareGeometryChange();
-	this->strokedPath.clear();
-	this->rawPath.lineTo(pt);
-	QRectF ptBounds(pt.x() - pen().widthF(), pt.y() - pen().widthF(), pen().widthF() * 2, pen().widthF() * 2);
-	this->bounds = this->bounds.united(ptBounds);
-}
-void PenDrawing::updateStrokedPath() {
-	if (this->strokedPath.isEmpty()) {
-		QPainterPathStroker qpps(this->pen());
-		qpps.setWidth(4);
-		qpps.setCapStyle(Qt::PenCapStyle::RoundCap);
-		qpps.setJoinStyle(Qt::PenJoinStyle::RoundJoin);
-		this->strokedPath = qpps.createStroke(this->rawPath);
+	this->lastInput = pt;
+	this->smoothed += (QPointF(pt) - this->smoothed) * PEN_SMOOTHING;
+
+	qreal minStep = qMax<qreal>(1, this->pen().widthF() * PEN_MIN_STEP);
+	QPointF step = this->smoothed - this->tail.last();
+	if (QPointF::dotProduct(step, step) < minStep * minStep) {
+		return;
+	}
+
+	QRectF old = this->tailBounds();
+	this->tail << this->smoothed;
+	this->tailStroke.clear();
+
+	QRectF changed = old.united(this->tailBounds());
+	if (!this->bounds.contains(changed)) {
+		this->prepareGeometryChange();
+		this->bounds = this->bounds.united(changed.adjusted(-PEN_BOUNDS_SLACK, -PEN_BOUNDS_SLACK, PEN_BOUNDS_SLACK, PEN_BOUNDS_SLACK));
+	} else {
+		this->update(changed);
+	}
+
+	if (this->tail.size() >= PEN_CHUNK_POINTS) {
+		this->sealTail();
+	}
+}
+void PenDrawing::finish() {
+	if (this->lastInput != this->tail.last()) {
+		QRectF old = this->tailBounds();
+		this->tail << this->lastInput;
+		this->tailStroke.clear();
+		QRectF changed = old.united(this->tailBounds());
+		if (!this->bounds.contains(changed)) {
+			this->prepareGeometryChange();
+			this->bounds = this->bounds.united(changed);
+		} else {
+			this->update(changed);
+		}
+	}
+	this->sealTail();
+}
+QPainterPath PenDrawing::stroke(const QPolygonF &points) const {
+	QPainterPath path;
+	path.addPolygon(points);
+	QPainterPathStroker qpps(this->pen());
+	qpps.setCapStyle(Qt::PenCapStyle::RoundCap);
+	qpps.setJoinStyle(Qt::PenJoinStyle::RoundJoin);
+	return qpps.createStroke(path);
+}
+QRectF PenDrawing::tailBounds() const {
+	qreal w = this->pen().widthF();
+	return this->tail.boundingRect().adjusted(-w, -w, w, w);
+}
+void PenDrawing::sealTail() {
+	if (this->tail.size() < 2) {
+		return;
+	}
+	if (this->tailStroke.isEmpty()) {
+		this->tailStroke = this->stroke(this->tail);
 	}
+	this->chunks.append(Chunk{this->tailStroke, this->tailBounds()});
+	QPointF last = this->tail.last();
+	this->tail.clear();
+	this->tail << last;
+	this->tailStroke.clear();
 }
 
 DrawingUndoItem::DrawingUndoItem(SelectionWindow *parent, QGraphicsItem *item)
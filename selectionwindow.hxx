@@ -8,6 +8,8 @@
 #include <QGraphicsView>
 #include <QLabel>
 #include <QLayout>
+#include <QPainterPath>
+#include <QPolygonF>
 #include <QPushButton>
 #include <QTimer>
 #include <QToolBar>
@@ -15,7 +17,9 @@
 #include <QUndoStack>
 #include <QWidget>
 
+#include "encoder.hxx"
 #include "platform.hxx"
+#include "windowindex.hxx"
 
 class SelectionWindow;
 
@@ -82,7 +86,7 @@ class ZoomTooltip : public QWidget {
 	Q_OBJECT
  private:
 	Q_DISABLE_COPY(ZoomTooltip)
-	QPixmap img;
+	QImage img;
 	int scale;
 
 	void doResize();
@@ -94,38 +98,79 @@ class ZoomTooltip : public QWidget {
 	ZoomTooltip(QWidget *parent = nullptr);
 	virtual ~ZoomTooltip();
 
-	void setImage(QPixmap image);
+	void setImage(QImage image);
 	void setScale(int scale);
 };
 
-class ShotItem : public QGraphicsPixmapItem {
+// Draws the capture's tiles and takes the mouse for the selection tools
+class ShotItem : public QGraphicsItem {
  public:
 	ShotItem(SelectionWindow *);
 	virtual ~ShotItem();
 
+	void setBounds(QRect bounds);
+
+	QRectF boundingRect() const override;
+	void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
+
  protected:
 	virtual void mouseDoubleClickEvent(QGraphicsSceneMouseEvent *) override;
 	virtual void mouseMoveEvent(QGraphicsSceneMouseEvent *) override;
 	virtual void mousePressEvent(QGraphicsSceneMouseEvent *) override;
 	virtual void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
 	virtual void hoverMoveEvent(QGraphicsSceneHoverEvent *) override;
+	virtual void hoverLeaveEvent(QGraphicsSceneHoverEvent *) override;
 
  private:
 	SelectionWindow *win;
+	QRect bounds;
+};
+
+// Dims everything but the selection. It is drawn as four rects around the hole, and moving the
+// hole only repaints the strips that changed.
+class DimOverlayItem : public QGraphicsItem {
+	QRect bounds;
+	QRect hole;
+	QColor color;
+
+ public:
+	explicit DimOverlayItem(QColor color);
+	virtual ~DimOverlayItem();
+
+	void setBounds(QRect bounds);
+	// an empty hole dims everything
+	void setHole(QRect hole);
+
+	QRectF boundingRect() const override;
+	void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
 };
 
+// A freehand stroke. Input is smoothed and thinned as it arrives, and every so many points the
+// tail is stroked once and kept, so each new point only re-strokes the short unfinished part.
 class PenDrawing : public QAbstractGraphicsShapeItem {
-	QPainterPath rawPath;
+	struct Chunk {
+		QPainterPath stroke;
+		QRectF bounds;
+	};
+	QList<Chunk> chunks;
+	// points not in a chunk yet; the first is the last point of the previous chunk
+	QPolygonF tail;
+	QPainterPath tailStroke;
+	QPointF smoothed;
+	QPointF lastInput;
 	QRectF bounds;
-	QPainterPath strokedPath;
 
-	void updateStrokedPath();
+	QPainterPath stroke(const QPolygonF &points) const;
+	QRectF tailBounds() const;
+	void sealTail();
 
  public:
 	PenDrawing(QPen pen, QPoint start);
 	virtual ~PenDrawing();
 
 	void addPoint(QPoint);
+	// ends the stroke at the last input point rather than the smoothed one
+	void finish();
 
 	QRectF boundingRect() const override;
 	void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget = nullptr) override;
@@ -156,6 +201,11 @@ class SelectionWindow : public QWidget {
 	explicit SelectionWindow(QWidget *parent = nullptr);
 	virtual ~SelectionWindow();
 
+	// Captures the screen into a new window, reusing the prewarmed one if there is one
+	static SelectionWindow *capture();
+	// Keep a fully built hidden window around so capture() only has to grab pixels
+	static void enablePrewarm();
+
 	void setPicking(bool picking);
 	virtual void setVisible(bool visible) override;
 
@@ -169,17 +219,36 @@ class SelectionWindow : public QWidget {
 	void pickColorSelected(QColor color);
 
  private:
+	static SelectionWindow *prewarmed;
+	static bool prewarmEnabled;
+	static void prewarm();
+
+	void takeScreenshot();
 	void geometryChanged(QEvent *);
 
-	QPixmap pixmap();
-	void saveTo(QString path);
-	QString savePath();
+	// the selection as it will be exported, cached until the selection, drawings or cursor change
+	QImage image();
+	QImage exportCache;
+	QRect exportCacheRect;
+	bool exportCacheCursor;
+
+	// encodes on a worker; done runs on the GUI thread once the file is in place
+	void saveTo(QString path, SaveFormat format, std::function<void(bool ok)> done = {});
+	QString savePath(const SaveFormat &format);
 
 	bool picking;
 	bool pickedLock;
 	QPoint pickPos;
+	// hover events can come much faster than frames, so moves are applied at most once per frame
+	QTimer *pickTimer;
+	bool pickPending;
+	void queuePickMoved();
 	void pickMoved();
 	void pickSelected();
+	// the color at pos, averaged over pickAverage x pickAverage pixels
+	QColor sampleColor(QPoint pos) const;
+	int pickRadius;
+	int pickAverage;
 	ZoomTooltip *pickTooltip;
 
 	QToolBar *shotToolbar;
@@ -193,21 +262,45 @@ class SelectionWindow : public QWidget {
 
 	QGraphicsView *selectionView;
 	QGraphicsScene *scene;
-	QGraphicsPathItem *selectionItem;
+	DimOverlayItem *selectionItem;
 	ShotItem *shotItem;
 	QGraphicsPixmapItem *cursorItem;
 
 	QRect desktopGeometry;
 	qint8 recursingGeometry;
 
-	QList<OpenWindow> openWindows;
+	// in scene coordinates
+	WindowIndex windowIndex;
+	int hoveredWindow;
+	QGraphicsRectItem *hoverItem;
+	// outlines window, or nothing if it is -1
+	void hoverWindow(int window);
+	void selectWindow(int window);
 
 	QPoint selectionStart;
 	QPoint selectionEnd;
 	QRect selection;
 	void selectionMoved();
 
-	QPixmap shot;
+	struct ShotTile {
+		// in scene coordinates
+		QRect geometry;
+		// CPU side copy, so exports and sampling don't need to read the pixmap back
+		QImage image;
+		QPixmap pixmap;
+	};
+	// one per screen, so the space between screens takes no memory
+	QList<ShotTile> shotTiles;
+	// the tile shown at pos, or nullptr
+	const ShotTile *tileAt(QPoint pos) const;
+	// whether rect is inside tile and no other tile overlaps it
+	bool tileCovers(const ShotTile *tile, QRect rect) const;
+	// the capture under rect, transparent where no screen covers it
+	QImage shotRegion(QRect rect) const;
+	// set by each capture, cleared once the overlay has been drawn for it
+	bool awaitingFirstFrame;
+	// when the last frame was shown, for tracing frame times
+	qint64 lastFrameSwap;
 
 	QPoint cursorPosition;
 	QPixmap cursor;
@@ -0,0 +1,154 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "trace.hxx"
+
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QFile>
+#include <chrono>
+
+struct TraceEvent {
+	const char *name;
+	char phase;
+	qint64 ts;
+	qint64 dur;
+	int tid;
+	QString detail;
+	double value;
+};
+
+std::atomic<bool> Trace::active = false;
+static QMutex traceMutex;
+static QString tracePath;
+// events recorded since the last flush
+static QList<TraceEvent> traceEvents;
+// held while writing, so flushes from different threads don't interleave
+static QMutex traceFileMutex;
+static bool traceFileStarted = false;
+
+// if nothing flushes for this long, the oldest unflushed events are dropped
+static const qsizetype MAX_PENDING_EVENTS = 100000;
+
+static void record(TraceEvent event) {
+	QMutexLocker lock(&traceMutex);
+	if (traceEvents.size() >= MAX_PENDING_EVENTS) {
+		traceEvents.remove(0, MAX_PENDING_EVENTS / 2);
+	}
+	traceEvents.append(std::move(event));
+}
+
+void Trace::init(const QString &path) {
+	if (path.isEmpty() || Trace::enabled()) {
+		return;
+	}
+
+	{
+		QMutexLocker lock(&traceMutex);
+		tracePath = path;
+	}
+	active = true;
+	qInfo() << "tracing to" << path;
+
+	if (QCoreApplication::instance()) {
+		QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, &Trace::flush);
+	}
+}
+
+qint64 Trace::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::complete(const char *name, qint64 start, qint64 end, const QString &detail) {
+	if (!Trace::enabled()) {
+		return;
+	}
+	record(TraceEvent{name, 'X', start, end - start, gettid(), detail, 0});
+}
+
+void Trace::instant(const char *name, const QString &detail) {
+	if (!Trace::enabled()) {
+		return;
+	}
+	record(TraceEvent{name, 'i', Trace::now(), 0, gettid(), detail, 0});
+}
+
+void Trace::counter(const char *name, double value) {
+	if (!Trace::enabled()) {
+		return;
+	}
+	record(TraceEvent{name, 'C', Trace::now(), 0, gettid(), {}, value});
+}
+
+void Trace::flush() {
+	if (!Trace::enabled()) {
+		return;
+	}
+
+	QMutexLocker fileLock(&traceFileMutex);
+
+	QList<TraceEvent> pending;
+	QString path;
+	{
+		QMutexLocker lock(&traceMutex);
+		path = tracePath;
+		pending.swap(traceEvents);
+	}
+	if (pending.isEmpty() && traceFileStarted) {
+		return;
+	}
+
+	QByteArray out;
+	if (!traceFileStarted) {
+		out.append("[\n");
+	}
+	for (const TraceEvent &ev : std::as_const(pending)) {
+		QJsonObject obj{
+			{"name", ev.name},
+			{"ph", QString(QChar(ev.phase))},
+			{"ts", ev.ts},
+			{"pid", (qint64)getpid()},
+			{"tid", ev.tid},
+		};
+		if (ev.phase == 'X') {
+			obj["dur"] = ev.dur;
+		} else if (ev.phase == 'C') {
+			obj["args"] = QJsonObject{{"value", ev.value}};
+		} else {
+			// instants are drawn across their thread rather than the whole process
+			obj["s"] = "t";
+		}
+		if (!ev.detail.isEmpty()) {
+			obj["args"] = QJsonObject{{"detail", ev.detail}};
+		}
+		out.append(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+		out.append(",\n");
+	}
+
+	// the first flush replaces whatever an earlier run left, later ones add to it
+	QFile file(path);
+	QIODevice::OpenMode mode = traceFileStarted ? QIODevice::Append : QIODevice::WriteOnly | QIODevice::Truncate;
+	if (!file.open(mode)) {
+		qWarning() << "unable to open trace" << path << file.errorString();
+		return;
+	}
+	if (file.write(out) != out.size()) {
+		qWarning() << "unable to write trace" << path << file.errorString();
+	}
+	traceFileStarted = true;
+}
+
+TraceSpan::TraceSpan(const char *name, const QString &detail)
+	: name(name), detail(Trace::enabled() ? detail : QString()), start(Trace::enabled() ? Trace::now() : 0) {
+}
+
+TraceSpan::~TraceSpan() {
+	if (this->start != 0) {
+		Trace::complete(this->name, this->start, Trace::now(), this->detail);
+	}
+}
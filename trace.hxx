@@ -0,0 +1,44 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef TRACE_HXX
+#define TRACE_HXX
+
+#include <QString>
+#include <atomic>
+
+// Records timing spans as Chrome trace events, for chrome://tracing or ui.perfetto.dev. Off
+// unless SHARKS_TRACE or [trace] file names an output file; when off every call is a single
+// relaxed load. Each flush appends the events recorded since the last one, in the JSON array
+// format that the viewers accept without a closing bracket, so a long running instance never
+// holds or rewrites its whole history.
+class Trace {
+	static std::atomic<bool> active;
+
+ public:
+	static void init(const QString &path);
+	static bool enabled() {
+		return active.load(std::memory_order_relaxed);
+	}
+
+	// microseconds on the monotonic clock
+	static qint64 now();
+	static void complete(const char *name, qint64 start, qint64 end, const QString &detail = {});
+	static void instant(const char *name, const QString &detail = {});
+	// a sample of a value that is graphed over time
+	static void counter(const char *name, double value);
+	static void flush();
+};
+
+// Records the time between construction and destruction
+class TraceSpan {
+	const char *name;
+	QString detail;
+	qint64 start;
+
+ public:
+	explicit TraceSpan(const char *name, const QString &detail = {});
+	~TraceSpan();
+};
+
+#endif	// TRACE_HXX
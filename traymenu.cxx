@@ -6,53 +6,63 @@
 #include <QApplication>
 #include <QIcon>
 #include <QSystemTrayIcon>
-#include <QThread>
+#include <QTimer>
 
 #include "QHotkey/qhotkey.h"
 #include "config.hxx"
 #include "selectionwindow.hxx"
+#include "trace.hxx"
 
-static void addGlobalKey(QAction *action, std::string_view name, bool *retryAdd) {
+// the instance we just asked to exit can hold on to its grabs for a moment, so failed
+// registrations are retried with backoff until this long has passed
+static const int HOTKEY_RETRY_FIRST_MS = 25;
+static const int HOTKEY_RETRY_MAX_MS = 1000;
+static const int HOTKEY_RETRY_TOTAL_MS = 10000;
+
+static void retryRegister(QHotkey *hotkey, QKeySequence key, QString name, int delay, int waited) {
+	QTimer::singleShot(delay, hotkey, [=]() {
+		hotkey->setRegistered(true);
+		if (hotkey->isRegistered()) {
+			return;
+		}
+		if (waited + delay >= HOTKEY_RETRY_TOTAL_MS) {
+			qInfo() << "Failed to register" << key << "for" << name;
+			return;
+		}
+		retryRegister(hotkey, key, name, qMin(delay * 2, HOTKEY_RETRY_MAX_MS), waited + delay);
+	});
+}
+
+static void addGlobalKey(QAction *action, std::string_view name) {
 	for (const auto &key : Config::parseHotkeys(config->root["globalkeys"][name])) {
 		auto *hotkey = new QHotkey(key, true, action);
-		QObject::connect(hotkey, &QHotkey::activated, action, [action]() {
+		QObject::connect(hotkey, &QHotkey::activated, action, [action, key]() {
+			if (Trace::enabled()) {
+				Trace::instant("trigger", "hotkey " + key.toString());
+			}
 			action->activate(QAction::Trigger);
 		});
 		if (!hotkey->isRegistered()) {
-			if (*retryAdd) {
-				// sometimes the killed duplicate is still holding the keybind, so wait a bit for it to finish
-				QThread::sleep(50);
-				*retryAdd = false;
-				hotkey->setRegistered(true);
-				if (!hotkey->isRegistered()) {
-					qInfo() << "Failed to register" << key << "for" << name;
-				}
-			}
+			retryRegister(hotkey, key, QString::fromUtf8(name.data(), name.size()), HOTKEY_RETRY_FIRST_MS, 0);
 		}
 	}
 }
 
 TrayMenu::TrayMenu(QWidget *parent) : QMenu(parent) {
-	auto *takeScreenshot = new QAction(QIcon(":/icon.svg"), "Take screenshot", this);
-	connect(takeScreenshot, &QAction::triggered, this, [this]() {
-		auto *win = new SelectionWindow(this);
+	this->takeScreenshot = new QAction(QIcon(":/icon.svg"), "Take screenshot", this);
+	connect(this->takeScreenshot, &QAction::triggered, this, []() {
+		auto *win = SelectionWindow::capture();
 		win->setVisible(true);
 	});
-	this->addAction(takeScreenshot);
+	this->addAction(this->takeScreenshot);
 
-	auto *picker = new QAction(QIcon("find-location-symbolic"), "Color picker", this);
-	connect(picker, &QAction::triggered, this, [this]() {
-		auto *win = new SelectionWindow(this);
+	this->picker = new QAction(QIcon("find-location-symbolic"), "Color picker", this);
+	connect(this->picker, &QAction::triggered, this, []() {
+		auto *win = SelectionWindow::capture();
 		win->setPicking(true);
 		win->setVisible(true);
 	});
-	this->addAction(picker);
-
-	if (QHotkey::isPlatformSupported()) {
-		bool retryAdd = true;
-		addGlobalKey(takeScreenshot, "screenshot", &retryAdd);
-		addGlobalKey(picker, "picker", &retryAdd);
-	}
+	this->addAction(this->picker);
 
 	addSeparator();
 
@@ -65,6 +75,13 @@ TrayMenu::TrayMenu(QWidget *parent) : QMenu(parent) {
 
 TrayMenu::~TrayMenu() {}
 
+void TrayMenu::registerHotkeys() {
+	if (QHotkey::isPlatformSupported()) {
+		addGlobalKey(this->takeScreenshot, "screenshot");
+		addGlobalKey(this->picker, "picker");
+	}
+}
+
 void TrayMenu::createTrayIcon() {
 	auto *tray = new QSystemTrayIcon(QIcon(":/icon.svg"), this);
 	tray->setToolTip(QApplication::applicationDisplayName());
@@ -10,11 +10,17 @@ class TrayMenu : public QMenu {
 	Q_OBJECT
  private:
 	Q_DISABLE_COPY(TrayMenu)
+
+	QAction *takeScreenshot;
+	QAction *picker;
+
  public:
 	explicit TrayMenu(QWidget *parent = nullptr);
 	virtual ~TrayMenu();
 
 	void createTrayIcon();
+	// grabs the global keys; done separately so an instance being replaced can let go of them first
+	void registerHotkeys();
 };
 
 #endif	// TRAYMENU_HXX
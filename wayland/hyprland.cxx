@@ -5,15 +5,41 @@
 
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDeadlineTimer>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLocalSocket>
+#include <QSet>
+#include <algorithm>
+#include <cstring>
+
+#include "trace.hxx"
 
 #ifdef SHARKS_HAS_WAYLAND
 
-Hyprland::Hyprland(QString socketPath)
-	: socketPath(socketPath) {
+// the window list is a nicety; don't hold the overlay for it
+static const int IPC_TIMEOUT_MS = 500;
+// how long to wait for the overlay's openwindow event before moving it anyway
+static const int FULLSCREEN_FALLBACK_MS = 250;
+
+Hyprland::Hyprland(QString socketPath, QString eventSocketPath, QObject *parent)
+	: QObject(parent), socketPath(socketPath), eventSocketPath(eventSocketPath), fullscreenWanted(false) {
+	this->fullscreenFallback = new QTimer(this);
+	this->fullscreenFallback->setSingleShot(true);
+	this->fullscreenFallback->setInterval(FULLSCREEN_FALLBACK_MS);
+	connect(this->fullscreenFallback, &QTimer::timeout, this, &Hyprland::sendFullscreen);
+
+	this->events = new QLocalSocket(this);
+	connect(this->events, &QLocalSocket::readyRead, this, &Hyprland::readEvents);
+	connect(this->events, &QLocalSocket::errorOccurred, this, [this](QLocalSocket::LocalSocketError err) {
+		qWarning() << "hyprland events" << this->events->errorString();
+	});
+	this->events->connectToServer(this->eventSocketPath, QIODevice::ReadOnly);
 }
 
-Hyprland *Hyprland::create() {
+Hyprland *Hyprland::create(QObject *parent) {
 	auto his = qgetenv("HYPRLAND_INSTANCE_SIGNATURE");
 	auto rtDir = qgetenv("XDG_RUNTIME_DIR");
 
@@ -21,23 +47,54 @@ Hyprland *Hyprland::create() {
 		return nullptr;
 	}
 
-	QString socketPath = QString("%1/hypr/%2/.socket.sock").arg(rtDir, his);
-	return new Hyprland(socketPath);
+	QString socketDir = QString("%1/hypr/%2/").arg(rtDir, his);
+	return new Hyprland(socketDir + ".socket.sock", socketDir + ".socket2.sock", parent);
 }
-void Hyprland::sendMessage(QByteArray message) {
-	auto *sock = new QLocalSocket;
 
+void Hyprland::sendMessage(QByteArray message) {
+	auto *sock = new QLocalSocket(this);
+	connect(sock, &QLocalSocket::connected, sock, [sock, message]() {
+		sock->write(message);
+	});
+	// hyprland hangs up once it has answered
+	connect(sock, &QLocalSocket::disconnected, sock, &QObject::deleteLater);
+	connect(sock, &QLocalSocket::readyRead, sock, [sock]() {
+		sock->readAll();
+	});
+	connect(sock, &QLocalSocket::errorOccurred, sock, [sock](QLocalSocket::LocalSocketError err) {
+		if (err != QLocalSocket::PeerClosedError) {
+			qWarning() << "hyprland ipc" << sock->errorString();
+		}
+		sock->deleteLater();
+	});
 	sock->connectToServer(this->socketPath, QIODevice::ReadWrite);
-	sock->waitForConnected();
+}
 
-	sock->write(message);
-	sock->flush();
+void Hyprland::readEvents() {
+	this->eventInput += this->events->readAll();
+	qsizetype end;
+	while ((end = this->eventInput.indexOf('\n')) >= 0) {
+		QByteArray line = this->eventInput.left(end);
+		this->eventInput.remove(0, end + 1);
 
-	// wait for a response so we don't close the socket before the request is written
-	QObject::connect(sock, &QLocalSocket::readyRead, sock, &QObject::deleteLater);
+		// openwindow>>ADDRESS,WORKSPACE,CLASS,TITLE, and the title can have commas of its own
+		if (!this->fullscreenWanted || !line.startsWith("openwindow>>")) {
+			continue;
+		}
+		QString title = QString::fromUtf8(line.mid(strlen("openwindow>>"))).section(',', 3);
+		if (title == QGuiApplication::applicationDisplayName()) {
+			this->sendFullscreen();
+		}
+	}
 }
 
-void Hyprland::fullscreen() {
+void Hyprland::sendFullscreen() {
+	if (!this->fullscreenWanted) {
+		return;
+	}
+	this->fullscreenWanted = false;
+	this->fullscreenFallback->stop();
+
 	this->sendMessage(QString(
 		"[[BATCH]]/"
 		"dispatch moveoutofgroup pid:%1;"
@@ -45,7 +102,102 @@ void Hyprland::fullscreen() {
 		"dispatch movewindowpixel exact 0 0,pid:%1")
 			.arg(QCoreApplication::applicationPid())
 			.toUtf8());
-	qDebug() << "Sent";
+	Trace::instant("hyprland fullscreen sent");
+}
+
+// hyprland answers one request per connection and hangs up when it's done
+static QJsonDocument requestJson(const QString &socketPath, QByteArray request, QDeadlineTimer deadline) {
+	QLocalSocket sock;
+	sock.connectToServer(socketPath, QIODevice::ReadWrite);
+	if (!sock.waitForConnected(deadline.remainingTime())) {
+		qWarning() << "unable to connect to hyprland" << sock.errorString();
+		return {};
+	}
+
+	sock.write(request);
+	QByteArray reply;
+	while (sock.waitForReadyRead(deadline.remainingTime())) {
+		reply += sock.readAll();
+	}
+	reply += sock.readAll();
+
+	QJsonParseError err;
+	QJsonDocument doc = QJsonDocument::fromJson(reply, &err);
+	if (doc.isNull()) {
+		qWarning() << "unable to parse hyprland" << request << "reply" << err.errorString();
+	}
+	return doc;
+}
+
+static bool truthy(const QJsonValue &v) {
+	// some versions report fullscreen as a mode number rather than a bool
+	return v.isBool() ? v.toBool() : v.toInt() != 0;
+}
+
+QList<OpenWindow> Hyprland::getWindows() const {
+	QDeadlineTimer deadline(IPC_TIMEOUT_MS);
+
+	QSet<int> visibleWorkspaces;
+	for (const QJsonValue &v : requestJson(this->socketPath, "j/monitors", deadline).array()) {
+		QJsonObject monitor = v.toObject();
+		visibleWorkspaces.insert(monitor["activeWorkspace"].toObject()["id"].toInt());
+		int special = monitor["specialWorkspace"].toObject()["id"].toInt();
+		if (special != 0) {
+			visibleWorkspaces.insert(special);
+		}
+	}
+
+	struct Client {
+		OpenWindow window;
+		bool fullscreen;
+		bool floating;
+		int focusHistory;
+	};
+	QList<Client> clients;
+	for (const QJsonValue &v : requestJson(this->socketPath, "j/clients", deadline).array()) {
+		QJsonObject client = v.toObject();
+		if (!client["mapped"].toBool() || client["hidden"].toBool()
+			|| !visibleWorkspaces.contains(client["workspace"].toObject()["id"].toInt())
+			|| client["pid"].toInteger() == QCoreApplication::applicationPid()) {
+			continue;
+		}
+		QJsonArray at = client["at"].toArray();
+		QJsonArray size = client["size"].toArray();
+		clients.push_back(Client{
+			OpenWindow{QRect(at[0].toInt(), at[1].toInt(), size[0].toInt(), size[1].toInt()), client["title"].toString()},
+			truthy(client["fullscreen"]),
+			client["floating"].toBool(),
+			client["focusHistoryID"].toInt(),
+		});
+	}
+
+	// fullscreen windows cover floating ones, which cover tiled ones; within each, the most
+	// recently focused is on top
+	std::stable_sort(clients.begin(), clients.end(), [](const Client &a, const Client &b) {
+		if (a.fullscreen != b.fullscreen) {
+			return a.fullscreen;
+		}
+		if (a.floating != b.floating) {
+			return a.floating;
+		}
+		return a.focusHistory < b.focusHistory;
+	});
+
+	QList<OpenWindow> out;
+	out.reserve(clients.size());
+	for (const Client &c : std::as_const(clients)) {
+		out.push_back(c.window);
+	}
+	return out;
+}
+
+void Hyprland::fullscreen() {
+	// the overlay opens after this, so wait for hyprland to tell us about it
+	this->fullscreenWanted = true;
+	this->fullscreenFallback->start();
+	if (this->events->state() == QLocalSocket::UnconnectedState) {
+		this->events->connectToServer(this->eventSocketPath, QIODevice::ReadOnly);
+	}
 }
 
 #endif
\ No newline at end of file
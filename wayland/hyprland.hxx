@@ -8,16 +8,40 @@
 
 #ifdef SHARKS_HAS_WAYLAND
 
-class Hyprland {
+#include <QLocalSocket>
+#include <QObject>
+#include <QTimer>
+
+#include "platform.hxx"
+
+// Hyprland takes one request per connection, so those are still sent on their own sockets, just
+// without blocking. Events come over socket2, which is held open so the overlay can be moved as
+// soon as it opens.
+class Hyprland : public QObject {
+	Q_OBJECT
+	Q_DISABLE_COPY(Hyprland)
+
 	const QString socketPath;
+	const QString eventSocketPath;
+	QLocalSocket *events;
+	QByteArray eventInput;
+
+	bool fullscreenWanted;
+	// in case the openwindow event never comes
+	QTimer *fullscreenFallback;
 
-	explicit Hyprland(QString socketPath);
+	Hyprland(QString socketPath, QString eventSocketPath, QObject *parent);
+	void readEvents();
+	void sendFullscreen();
 
  public:
-	static Hyprland *create();
+	static Hyprland *create(QObject *parent);
 
 	void sendMessage(QByteArray message);
 	void fullscreen();
+	// Reads the windows on the visible workspaces, topmost first. This blocks, so it is meant to run
+	// on a worker.
+	QList<OpenWindow> getWindows() const;
 };
 
 #endif
@@ -6,18 +6,67 @@
 #ifdef SHARKS_HAS_WAYLAND
 
 #include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QLocalSocket>
+#include <cstring>
 
-Sway::Sway(const char *socketPath) : socketPath(socketPath) {
+#include "trace.hxx"
+
+// GET_TREE answers quickly; if it doesn't, selecting windows isn't worth holding the overlay for
+static const int IPC_TIMEOUT_MS = 500;
+static const quint32 IPC_RUN_COMMAND = 0;
+static const quint32 IPC_SUBSCRIBE = 2;
+static const quint32 IPC_GET_TREE = 4;
+static const quint32 IPC_EVENT_BIT = 0x80000000;
+static const quint32 IPC_EVENT_WINDOW = 3;
+static const int IPC_HEADER_SIZE = 14;
+// how long to wait for the overlay's window event before fullscreening it by its pid instead
+static const int FULLSCREEN_FALLBACK_MS = 250;
+
+Sway::Sway(const char *socketPath, QObject *parent)
+	: QObject(parent), socketPath(socketPath), fullscreenWanted(false) {
+	this->sock = new QLocalSocket(this);
+	connect(this->sock, &QLocalSocket::connected, this, [this]() {
+		this->sock->write(this->output);
+		this->output.clear();
+	});
+	connect(this->sock, &QLocalSocket::readyRead, this, &Sway::readPackets);
+	connect(this->sock, &QLocalSocket::disconnected, this, [this]() {
+		// whatever was in flight is gone; the next packet reconnects
+		this->input.clear();
+		this->pendingReplies.clear();
+	});
+	connect(this->sock, &QLocalSocket::errorOccurred, this, [this](QLocalSocket::LocalSocketError err) {
+		qWarning() << "sway ipc" << this->sock->errorString();
+		this->output.clear();
+		this->pendingReplies.clear();
+	});
+
+	this->fullscreenFallback = new QTimer(this);
+	this->fullscreenFallback->setSingleShot(true);
+	this->fullscreenFallback->setInterval(FULLSCREEN_FALLBACK_MS);
+	connect(this->fullscreenFallback, &QTimer::timeout, this, [this]() {
+		if (!this->fullscreenWanted) {
+			return;
+		}
+		this->fullscreenWanted = false;
+		this->sendPacket(IPC_RUN_COMMAND, QString("[pid=%1 title=\"^Sharks$\"] fullscreen enable global").arg(QCoreApplication::applicationPid()).toUtf8());
+	});
+
+	// connect now so we're subscribed before the first overlay maps
+	this->connectSocket();
 }
 
-Sway *Sway::create() {
+Sway *Sway::create(QObject *parent) {
 	const char *swaysockPath = ::getenv("SWAYSOCK");
 	if (swaysockPath == nullptr || swaysockPath[0] == '\0') {
 		return nullptr;
 	}
 
-	return new Sway(swaysockPath);
+	return new Sway(swaysockPath, parent);
 }
 
 static QByteArray swayPacketize(quint32 type, QByteArray payload) {
@@ -35,21 +84,158 @@ static QByteArray swayPacketize(quint32 type, QByteArray payload) {
 	return out;
 }
 
-void Sway::sendPacket(quint32 type, QByteArray payload) {
-	auto *sock = new QLocalSocket;
+void Sway::connectSocket() {
+	// subscribe ahead of anything already queued; connecting can finish before connectToServer returns
+	this->output.prepend(swayPacketize(IPC_SUBSCRIBE, "[\"window\"]"));
+	this->pendingReplies.prepend([](const QJsonDocument &reply) {
+		if (!reply["success"].toBool()) {
+			qWarning() << "unable to subscribe to sway window events";
+		}
+	});
+	this->sock->connectToServer(this->socketPath, QIODevice::ReadWrite);
+}
+
+void Sway::sendPacket(quint32 type, QByteArray payload, std::function<void(const QJsonDocument &)> reply) {
+	this->pendingReplies.push_back(std::move(reply));
+	if (this->sock->state() == QLocalSocket::ConnectedState) {
+		this->sock->write(swayPacketize(type, payload));
+		return;
+	}
+
+	this->output.append(swayPacketize(type, payload));
+	if (this->sock->state() == QLocalSocket::UnconnectedState) {
+		this->connectSocket();
+	}
+}
+
+void Sway::readPackets() {
+	this->input += this->sock->readAll();
+	while (this->input.size() >= IPC_HEADER_SIZE) {
+		// the length and type are in native order, right after the magic
+		quint32 length, type;
+		memcpy(&length, this->input.constData() + 6, sizeof(length));
+		memcpy(&type, this->input.constData() + 10, sizeof(type));
+		if (this->input.size() < IPC_HEADER_SIZE + qsizetype(length)) {
+			return;
+		}
+
+		QJsonDocument doc = QJsonDocument::fromJson(this->input.mid(IPC_HEADER_SIZE, length));
+		this->input.remove(0, IPC_HEADER_SIZE + length);
+
+		if (type & IPC_EVENT_BIT) {
+			this->handleEvent(type & ~IPC_EVENT_BIT, doc);
+		} else if (!this->pendingReplies.isEmpty()) {
+			auto reply = this->pendingReplies.takeFirst();
+			if (reply) {
+				reply(doc);
+			}
+		}
+	}
+}
+
+void Sway::handleEvent(quint32 type, const QJsonDocument &event) {
+	if (type != IPC_EVENT_WINDOW || !this->fullscreenWanted || event["change"].toString() != "new") {
+		return;
+	}
+
+	QJsonObject con = event["container"].toObject();
+	if (con["pid"].toInteger() != QCoreApplication::applicationPid()) {
+		return;
+	}
+
+	this->fullscreenWanted = false;
+	this->fullscreenFallback->stop();
+	this->sendPacket(IPC_RUN_COMMAND, QString("[con_id=%1] fullscreen enable global").arg(con["id"].toInteger()).toUtf8());
+	Trace::instant("sway fullscreen sent");
+}
+
+static bool readExactly(QLocalSocket &sock, qint64 size, QByteArray *out, QDeadlineTimer deadline) {
+	while (sock.bytesAvailable() < size) {
+		if (!sock.waitForReadyRead(deadline.remainingTime())) {
+			return false;
+		}
+	}
+	*out = sock.read(size);
+	return true;
+}
 
-	sock->connectToServer(this->socketPath, QIODevice::ReadWrite);
-	sock->waitForConnected();
+static QRect swayRect(const QJsonValue &v) {
+	QJsonObject r = v.toObject();
+	return QRect(r["x"].toInt(), r["y"].toInt(), r["width"].toInt(), r["height"].toInt());
+}
 
-	sock->write(swayPacketize(type, payload));
-	sock->flush();
+// views are the nodes with a pid; everything else is a container to look inside
+static void collectSwayViews(const QJsonObject &node, bool floating, QList<OpenWindow> &fullscreen, QList<OpenWindow> &floats, QList<OpenWindow> &tiled) {
+	if (node.contains("pid")) {
+		if (!node["visible"].toBool() || node["pid"].toInteger() == QCoreApplication::applicationPid()) {
+			return;
+		}
+		QRect rect = swayRect(node["rect"]);
+		QRect content = swayRect(node["window_rect"]).translated(rect.topLeft());
+		OpenWindow w{content, node["name"].toString()};
+		if (node["fullscreen_mode"].toInt() != 0) {
+			fullscreen.push_back(w);
+		} else if (floating) {
+			floats.push_back(w);
+		} else {
+			tiled.push_back(w);
+		}
+		return;
+	}
 
-	// wait for a response so we don't close the socket before the request is written
-	QObject::connect(sock, &QLocalSocket::readyRead, sock, &QObject::deleteLater);
+	for (const QJsonValue &child : node["nodes"].toArray()) {
+		collectSwayViews(child.toObject(), floating, fullscreen, floats, tiled);
+	}
+	// later floating nodes are stacked above earlier ones
+	QJsonArray floatingNodes = node["floating_nodes"].toArray();
+	for (qsizetype i = floatingNodes.size() - 1; i >= 0; i--) {
+		collectSwayViews(floatingNodes[i].toObject(), true, fullscreen, floats, tiled);
+	}
+}
+
+QList<OpenWindow> Sway::getWindows() const {
+	QDeadlineTimer deadline(IPC_TIMEOUT_MS);
+	QLocalSocket sock;
+	sock.connectToServer(this->socketPath, QIODevice::ReadWrite);
+	if (!sock.waitForConnected(deadline.remainingTime())) {
+		qWarning() << "unable to connect to sway" << sock.errorString();
+		return {};
+	}
+
+	sock.write(swayPacketize(IPC_GET_TREE, {}));
+	QByteArray header;
+	QByteArray payload;
+	if (!readExactly(sock, IPC_HEADER_SIZE, &header, deadline)) {
+		qWarning() << "no window tree from sway" << sock.errorString();
+		return {};
+	}
+	// the length is in native order, right after the magic
+	quint32 length;
+	memcpy(&length, header.constData() + 6, sizeof(length));
+	if (!readExactly(sock, length, &payload, deadline)) {
+		qWarning() << "no window tree from sway" << sock.errorString();
+		return {};
+	}
+
+	QJsonParseError err;
+	QJsonDocument tree = QJsonDocument::fromJson(payload, &err);
+	if (tree.isNull()) {
+		qWarning() << "unable to parse sway window tree" << err.errorString();
+		return {};
+	}
+
+	QList<OpenWindow> fullscreen, floats, tiled;
+	collectSwayViews(tree.object(), false, fullscreen, floats, tiled);
+	return fullscreen + floats + tiled;
 }
 
 void Sway::fullscreen() {
-	this->sendPacket(0 /* RUN_COMMAND */, QString("for_window [pid=%1 title=\"^Sharks$\"] fullscreen enable global").arg(QCoreApplication::applicationPid()).toUtf8());
+	// the overlay maps after this, so wait for sway to tell us about it
+	this->fullscreenWanted = true;
+	this->fullscreenFallback->start();
+	if (this->sock->state() == QLocalSocket::UnconnectedState) {
+		this->connectSocket();
+	}
 }
 
 #endif
\ No newline at end of file
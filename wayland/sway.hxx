@@ -7,18 +7,47 @@
 #ifdef SHARKS_HAS_WAYLAND
 
 #include <QByteArray>
+#include <QJsonDocument>
+#include <QLocalSocket>
+#include <QObject>
+#include <QTimer>
+#include <functional>
 
-class Sway {
-	const char *socketPath;
+#include "platform.hxx"
+
+// Holds one connection to sway's IPC for the life of the process. Commands are written without
+// waiting and replies are matched up as they arrive, and the same connection is subscribed to
+// window events so the overlay can be fullscreened as soon as it maps.
+class Sway : public QObject {
+	Q_OBJECT
+	Q_DISABLE_COPY(Sway)
 
-	explicit Sway(const char *socketPath);
+	const char *socketPath;
+	QLocalSocket *sock;
+	QByteArray input;
+	// written once the socket connects
+	QByteArray output;
+	// one per packet sent, in order
+	QList<std::function<void(const QJsonDocument &)>> pendingReplies;
+
+	bool fullscreenWanted;
+	// in case the window event never comes
+	QTimer *fullscreenFallback;
+
+	Sway(const char *socketPath, QObject *parent);
+	void connectSocket();
+	void readPackets();
+	void handleEvent(quint32 type, const QJsonDocument &event);
 
  public:
-	static Sway *create();
+	static Sway *create(QObject *parent);
 
-	void sendPacket(quint32 type, QByteArray payload);
+	void sendPacket(quint32 type, QByteArray payload, std::function<void(const QJsonDocument &)> reply = {});
 
 	void fullscreen();
+	// Reads the visible windows from the layout tree, topmost first. This blocks, so it is meant
+	// to run on a worker.
+	QList<OpenWindow> getWindows() const;
 };
 
 #endif
@@ -5,38 +5,100 @@
 
 #ifdef SHARKS_HAS_WAYLAND
 
-#include <QTimer>
 
 #include "hyprland.hxx"
 #include "sway.hxx"
+#include "trace.hxx"
 #include "wlrscreengrabber.hxx"
 
 WaylandPlatform::WaylandPlatform()
 	: qWayland(Platform::nativeObject<QNativeInterface::QWaylandApplication>()),
-		sway(Sway::create()),
-		hyprland(Hyprland::create()),
+		compositorConnected(false),
+		sway(nullptr),
+		hyprland(nullptr),
 		wlrScreengrabber(WLRScreengrabber::create(qWayland->display())) {
 }
 
+void WaylandPlatform::connectCompositor() {
+	if (this->compositorConnected) {
+		return;
+	}
+	this->compositorConnected = true;
+	this->sway = Sway::create(this);
+	this->hyprland = Hyprland::create(this);
+}
+
 bool WaylandPlatform::available() {
 	return Platform::nativeObject<QNativeInterface::QWaylandApplication>() != nullptr;
 }
+void WaylandPlatform::trackOpenWindows() {
+	// the window event subscription is then in place well before the first overlay maps
+	this->connectCompositor();
+}
 void WaylandPlatform::waylandFullscreen() {
+	this->connectCompositor();
 	if (this->sway) {
 		this->sway->fullscreen();
 	}
 	if (this->hyprland) {
-		QTimer::singleShot(250, this, [this]() { this->hyprland->fullscreen(); });
+		this->hyprland->fullscreen();
+	}
+}
+void WaylandPlatform::prepareOpenWindows() {
+	// this comes before the overlay is shown, so the window event subscription is in place by then
+	this->connectCompositor();
+	Sway *sway = this->sway;
+	Hyprland *hyprland = this->hyprland;
+	if ((!sway && !hyprland) || this->pendingWindows.valid()) {
+		return;
 	}
+	this->pendingWindows = std::async(std::launch::async, [sway, hyprland]() {
+		TraceSpan span("compositor window list");
+		return sway ? sway->getWindows() : hyprland->getWindows();
+	});
 }
-QPixmap WaylandPlatform::getScreenshot(QRect geometry) {
+
+QList<OpenWindow> WaylandPlatform::getOpenWindows() {
+	if (!this->pendingWindows.valid()) {
+		this->prepareOpenWindows();
+		if (!this->pendingWindows.valid()) {
+			return Platform::getOpenWindows();
+		}
+	}
+
+	QList<OpenWindow> windows = this->pendingWindows.get();
 	if (this->wlrScreengrabber) {
-		return QPixmap::fromImage(this->wlrScreengrabber->grab(geometry));
+		for (OpenWindow &w : windows) {
+			w.geometry = this->wlrScreengrabber->mapFromLogical(w.geometry);
+		}
+	}
+	return windows;
+}
+
+QImage WaylandPlatform::getScreenshotImage(QRect geometry) {
+	if (this->wlrScreengrabber) {
+		return this->wlrScreengrabber->grab(geometry);
 	}
 
 	qWarning() << "Unable to get wayland screenshot";
 
-	return Platform::getScreenshot(geometry);
+	return Platform::getScreenshotImage(geometry);
+}
+
+QList<ScreenTile> WaylandPlatform::getScreenshotTiles(QRect geometry) {
+	if (this->wlrScreengrabber) {
+		return this->wlrScreengrabber->grabTiles(geometry);
+	}
+
+	return Platform::getScreenshotTiles(geometry);
+}
+
+QImage WaylandPlatform::getScreenshotIncremental(QRect geometry, QRegion *damage, int timeoutMs) {
+	if (this->wlrScreengrabber) {
+		return this->wlrScreengrabber->grabIncremental(geometry, damage, timeoutMs);
+	}
+
+	return Platform::getScreenshotIncremental(geometry, damage, timeoutMs);
 }
 
 bool WaylandPlatform::isWayland() {
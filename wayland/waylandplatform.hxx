@@ -7,6 +7,7 @@
 #ifdef SHARKS_HAS_WAYLAND
 
 #include <QGuiApplication>
+#include <future>
 #include <platform.hxx>
 
 class Sway;
@@ -18,17 +19,30 @@ class WaylandPlatform : public Platform {
 	Q_DISABLE_COPY(WaylandPlatform)
 
 	QNativeInterface::QWaylandApplication *qWayland;
+	// the compositor IPC connections are made by trackOpenWindows, or the first capture without
+	// it, so a headless capture doesn't pay for them
+	bool compositorConnected;
 	Sway *sway;
 	Hyprland *hyprland;
 	WLRScreengrabber *wlrScreengrabber;
 
+	void connectCompositor();
+
+	// started before the capture so the compositor's answer is in by the time it's wanted
+	std::future<QList<OpenWindow>> pendingWindows;
+
  public:
 	WaylandPlatform();
 
 	static bool available();
 
 	void waylandFullscreen() override;
-	QPixmap getScreenshot(QRect geometry) override;
+	void trackOpenWindows() override;
+	void prepareOpenWindows() override;
+	QList<OpenWindow> getOpenWindows() override;
+	QImage getScreenshotImage(QRect geometry) override;
+	QList<ScreenTile> getScreenshotTiles(QRect geometry) override;
+	QImage getScreenshotIncremental(QRect geometry, QRegion *damage, int timeoutMs) override;
 	bool isWayland() override;
 };
 
@@ -5,68 +5,159 @@
 
 #ifdef SHARKS_HAS_WAYLAND
 
+#include <poll.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <wayland-client.h>
 
 #include <QDataStream>
 #include <QGuiApplication>
-#include <QPainter>
-
+#include <QRegion>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <cerrno>
+#include <memory>
+
+#include "pixelkernels.hxx"
+#include "trace.hxx"
 #include "wayland-wlr-screencopy-unstable-v1-client-protocol.h"
 #include "wayland-xdg-output-unstable-v1-client-protocol.h"
 
-struct OutputGrab {
-	zwlr_screencopy_frame_v1 *frame = nullptr;
+// how long a capture waits on the compositor before giving up on the outputs that haven't finished
+static const int CAPTURE_DEADLINE_MS = 1000;
 
+// A wl_shm buffer kept on its output between grabs. Images wrapping its mapping hold a reference,
+// so the buffer is only written again once nothing is looking at it.
+struct OutputBuffer {
 	uint32_t format = 0;
 	uint32_t width = 0;
 	uint32_t height = 0;
 	uint32_t stride = 0;
 	wl_buffer *buffer = nullptr;
 
-	int shmFD = 0;
+	int shmFD = -1;
 	void *shm = nullptr;
 	size_t shmSize = 0;
 
-	uint32_t flags = 0;
+	// 24 bit formats are expanded into this, so it lives as long as the buffer
+	QImage expanded;
 
-	bool failed = false;
+	static std::shared_ptr<OutputBuffer> create(wl_shm *wlShm, uint32_t format, uint32_t width, uint32_t height, uint32_t stride) {
+		auto b = std::make_shared<OutputBuffer>();
+		b->format = format;
+		b->width = width;
+		b->height = height;
+		b->stride = stride;
 
-	OutputGrab() {
+		size_t size = size_t(stride) * height;
+		b->shmSize = size;
+
+		b->shmFD = memfd_create("sharks-screencopy", MFD_CLOEXEC);
+		if (b->shmFD == -1 || ftruncate(b->shmFD, size) == -1) {
+			qWarning() << "unable to allocate screencopy buffer" << errno;
+			return nullptr;
+		}
+
+		b->shm = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, b->shmFD, 0);
+		if (b->shm == MAP_FAILED) {
+			b->shm = nullptr;
+			qWarning() << "unable to map screencopy buffer" << errno;
+			return nullptr;
+		}
+
+		wl_shm_pool *pool = wl_shm_create_pool(wlShm, b->shmFD, size);
+		b->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
+		wl_shm_pool_destroy(pool);
+		return b;
 	}
 
-	~OutputGrab() {
+	~OutputBuffer() {
 		if (this->shm) munmap(this->shm, this->shmSize);
-		if (this->shmFD) close(this->shmFD);
+		if (this->shmFD != -1) close(this->shmFD);
 		if (this->buffer) wl_buffer_destroy(this->buffer);
-		if (this->frame) zwlr_screencopy_frame_v1_destroy(this->frame);
 	}
 
-	QImage asQImage() {
-		if (this->failed || !this->shm) {
+	bool matches(uint32_t format, uint32_t width, uint32_t height, uint32_t stride) const {
+		return this->format == format && this->width == width && this->height == height && this->stride == stride;
+	}
+
+	PixelRect bounds() const {
+		return PixelRect{0, 0, int32_t(this->width), int32_t(this->height)};
+	}
+
+	// converts rect of the buffer to something Qt can draw quickly and returns the whole buffer as
+	// an image. 32 bit formats are converted in place, so each pixel must only be converted once per copy
+	QImage convert(PixelRect rect) {
+		if (!this->shm) {
 			return {};
 		}
 
-		QImage::Format qfmt = QImage::Format_Invalid;
+		const auto &kernels = PixelKernels::get();
+		auto *base = reinterpret_cast<uchar *>(this->shm);
+		size_t len = rect.width;
+		auto eachRow = [&](auto fn) {
+			for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+				fn(reinterpret_cast<uint32_t *>(base + y * this->stride) + rect.x);
+			}
+		};
+
+		// https://doc.qt.io/qt-6/qimage.html#Format-enum
+		// https://wayland.freedesktop.org/docs/html/apa.html#protocol-spec-wl_shm-enum-format
 		switch (this->format) {
-			// case WL_SHM_FORMAT_ARGB8888: qfmt = QImage::Format_ARGB32_Premultiplied; break;
 			case WL_SHM_FORMAT_XRGB8888:
-				qfmt = QImage::Format_ARGB32;
-				break;
+				eachRow([&](uint32_t *row) { kernels.fillAlpha(row, len); });
+				return QImage(base, this->width, this->height, this->stride, QImage::Format_RGB32);
+			case WL_SHM_FORMAT_ARGB8888:
+				// wl_shm alpha formats are already premultiplied
+				return QImage(base, this->width, this->height, this->stride, QImage::Format_ARGB32_Premultiplied);
+			case WL_SHM_FORMAT_XBGR8888:
+				eachRow([&](uint32_t *row) { kernels.swapRedBlue(row, row, len, true); });
+				return QImage(base, this->width, this->height, this->stride, QImage::Format_RGB32);
+			case WL_SHM_FORMAT_ABGR8888:
+				eachRow([&](uint32_t *row) { kernels.swapRedBlue(row, row, len, false); });
+				return QImage(base, this->width, this->height, this->stride, QImage::Format_ARGB32_Premultiplied);
 			case WL_SHM_FORMAT_RGB888:
-				qfmt = QImage::Format_BGR888;
-				break;
-			case WL_SHM_FORMAT_BGR888:
-				qfmt = QImage::Format_RGB888;
-				break;
-			// https://doc.qt.io/qt-6/qimage.html#Format-enum
-			// https://wayland.freedesktop.org/docs/html/apa.html#protocol-spec-wl_shm-enum-format
+			case WL_SHM_FORMAT_BGR888: {
+				if (this->expanded.width() != int(this->width) || this->expanded.height() != int(this->height)) {
+					this->expanded = QImage(this->width, this->height, QImage::Format_RGB32);
+				}
+				bool swap = this->format == WL_SHM_FORMAT_BGR888;
+				for (int32_t y = rect.y; y < rect.y + rect.height; y++) {
+					auto *row = reinterpret_cast<uint32_t *>(this->expanded.scanLine(y)) + rect.x;
+					kernels.expand24(row, base + y * this->stride + rect.x * 3, len, swap);
+				}
+				return this->expanded;
+			}
 			default:
 				qInfo() << "unsupported pixel format 0x" << Qt::hex << this->format;
+				return {};
 		}
+	}
+};
+
+struct OutputGrab {
+	zwlr_screencopy_frame_v1 *frame = nullptr;
+	std::shared_ptr<OutputBuffer> buffer;
+
+	uint32_t flags = 0;
+	// what changed since the last copy_with_damage, in buffer coordinates
+	QRegion damage;
 
-		return QImage((uchar *)this->shm, this->width, this->height, this->stride, qfmt);
+	// logical position of the top left of the buffer
+	QPoint origin;
+	// logical size of the captured area, which the buffer may be a multiple of
+	QSize logicalSize;
+
+	bool withDamage = false;
+	bool ready = false;
+	bool failed = false;
+
+	OutputGrab() {
+	}
+
+	~OutputGrab() {
+		if (this->frame) zwlr_screencopy_frame_v1_destroy(this->frame);
 	}
 };
 
@@ -79,9 +170,21 @@ struct WLROutput {
 
 	int32_t x = 0;
 	int32_t y = 0;
+	int32_t width = 0;
+	int32_t height = 0;
 	int32_t transform = 0;
 
 	OutputGrab *grab = nullptr;
+	QList<std::shared_ptr<OutputBuffer>> buffers;
+
+	// where this output's pixels in the incremental frame came from, so we know when they are stale
+	std::weak_ptr<OutputBuffer> frameBuffer;
+	QPoint framePos;
+	int32_t frameTransform = 0;
+
+	// how the last capture placed this output, for mapping logical coordinates into it
+	QPoint lastOrigin;
+	qreal lastScale = 1;
 
 	WLROutput(WLRScreengrabber *g, wl_output *output, uint32_t name)
 		: parent(g),
@@ -92,8 +195,32 @@ struct WLROutput {
 	~WLROutput() {
 		if (this->xdgOutput) zxdg_output_v1_destroy(this->xdgOutput);
 		if (this->grab) delete this->grab;
+		this->buffers.clear();
 		wl_output_release(this->output);
 	}
+
+	// finds a buffer nobody else holds with the given parameters, dropping idle ones that don't match
+	std::shared_ptr<OutputBuffer> takeBuffer(uint32_t format, uint32_t width, uint32_t height, uint32_t stride) {
+		std::shared_ptr<OutputBuffer> found;
+		this->buffers.removeIf([&](const std::shared_ptr<OutputBuffer> &b) {
+			if (b.use_count() > 1) {
+				return false;
+			}
+			if (!found && b->matches(format, width, height, stride)) {
+				found = b;
+				return false;
+			}
+			return true;
+		});
+
+		if (!found) {
+			found = OutputBuffer::create(this->parent->shm, format, width, height, stride);
+			if (found) {
+				this->buffers.push_back(found);
+			}
+		}
+		return found;
+	}
 };
 
 WLRScreengrabber::WLRScreengrabber(wl_display *dpy)
@@ -130,7 +257,10 @@ static const zxdg_output_v1_listener xdgOutputListener{
 		WLROutput *o = (WLROutput*) data;
 		o->x = x;
 		o->y = y; },
-	.logical_size = [](void *, zxdg_output_v1 *, int32_t, int32_t) {},
+	.logical_size = [](void *data, zxdg_output_v1 *, int32_t width, int32_t height) {
+		WLROutput *o = (WLROutput*) data;
+		o->width = width;
+		o->height = height; },
 	.done = [](void *, zxdg_output_v1 *) {},
 	.name = [](void *, zxdg_output_v1 *, const char *) {},
 	.description = [](void *, zxdg_output_v1 *, const char *) {},
@@ -138,13 +268,13 @@ static const zxdg_output_v1_listener xdgOutputListener{
 
 static const wl_registry_listener registryListener{
 	.global = [](void *data, wl_registry *registry, uint32_t name, const char *interface, uint32_t version) {
-		Q_UNUSED(version);
-
 		WLRScreengrabber *self = (WLRScreengrabber*) data;
 		if (strcmp(interface, wl_shm_interface.name) == 0) {
 			self->shm = (wl_shm*) wl_registry_bind(registry, name, &wl_shm_interface, 1);
 		} else if (strcmp(interface, zwlr_screencopy_manager_v1_interface.name) == 0) {
-			self->copyMan = (zwlr_screencopy_manager_v1*) wl_registry_bind(registry, name, &zwlr_screencopy_manager_v1_interface, 1);
+			// copy_with_damage needs version 2
+			self->copyManVersion = std::min(version, 2u);
+			self->copyMan = (zwlr_screencopy_manager_v1*) wl_registry_bind(registry, name, &zwlr_screencopy_manager_v1_interface, self->copyManVersion);
 		} else if (strcmp(interface, wl_output_interface.name) == 0) {
 			auto *output = new WLROutput(self, (wl_output*) wl_registry_bind(registry, name, &wl_output_interface, 3), name);
 			if (self->xdgOutputMan) {
@@ -191,86 +321,342 @@ static const zwlr_screencopy_frame_v1_listener listener{
 			return;
 		}
 		auto g = o->grab;
-		g->format = format;
-		g->width = width;
-		g->height = height;
-		g->stride = stride;
-
-		size_t size = stride * height;
-		g->shmSize = size;
-
-		g->shmFD = memfd_create("", MFD_CLOEXEC);
-		ftruncate(g->shmFD, size);
-
-		g->shm = mmap(nullptr,size,  PROT_READ | PROT_WRITE, MAP_SHARED, g->shmFD, 0);
-		wl_shm_pool *pool = wl_shm_create_pool(o->parent->shm, g->shmFD, size);
-		g->buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, format);
-		wl_shm_pool_destroy(pool);
+		g->buffer = o->takeBuffer(format, width, height, stride);
+		if (!g->buffer) {
+			o->parent->outstanding--;
+			g->failed = true;
+			return;
+		}
 
-		zwlr_screencopy_frame_v1_copy(frame, g->buffer); },
+		if (g->withDamage) {
+			zwlr_screencopy_frame_v1_copy_with_damage(frame, g->buffer->buffer);
+		} else {
+			zwlr_screencopy_frame_v1_copy(frame, g->buffer->buffer);
+		} },
 	.flags = [](void *data, zwlr_screencopy_frame_v1 *, uint32_t flags) {
 		WLROutput *o = (WLROutput*) data;
 		o->grab->flags = flags; },
 	.ready = [](void *data, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t, uint32_t) {
 		WLROutput *o = (WLROutput*) data;
-		o->parent->outstanding--; },
+		o->parent->outstanding--;
+		o->grab->ready = true; },
 	.failed = [](void *data, zwlr_screencopy_frame_v1 *) {
 		WLROutput *o = (WLROutput*) data;
 		o->parent->outstanding--;
 		o->grab->failed = true; },
-	.damage = [](void *, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t, uint32_t, uint32_t) {},
+	.damage = [](void *data, zwlr_screencopy_frame_v1 *, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+		WLROutput *o = (WLROutput*) data;
+		o->grab->damage += QRect(x, y, width, height); },
 	.linux_dmabuf = [](void *, zwlr_screencopy_frame_v1 *, uint32_t, uint32_t, uint32_t) {},
 	.buffer_done = [](void *, zwlr_screencopy_frame_v1 *) {},
 };
 
-QImage WLRScreengrabber::grab(QRect geom) {
-	this->outstanding = this->outputs.size();
+// dispatches our queue until every frame has finished or the deadline passes. Returns false if it
+// gave up with frames still outstanding
+bool WLRScreengrabber::dispatchUntilDone(QDeadlineTimer deadline) {
+	while (this->outstanding > 0) {
+		if (wl_display_prepare_read_queue(this->dpy, this->q) != 0) {
+			if (wl_display_dispatch_queue_pending(this->dpy, this->q) == -1) {
+				return false;
+			}
+			continue;
+		}
+
+		wl_display_flush(this->dpy);
+
+		pollfd pfd{
+			.fd = wl_display_get_fd(this->dpy),
+			.events = POLLIN,
+			.revents = 0,
+		};
+		int ret = poll(&pfd, 1, int(deadline.remainingTime()));
+		if (ret <= 0) {
+			wl_display_cancel_read(this->dpy);
+			if (ret < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+
+		if (wl_display_read_events(this->dpy) == -1) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void releaseBuffer(void *buffer) {
+	delete reinterpret_cast<std::shared_ptr<OutputBuffer> *>(buffer);
+}
+
+QList<WLROutput *> WLRScreengrabber::captureOutputs(QRect region, bool withDamage, QDeadlineTimer deadline) {
+	this->outstanding = 0;
 	for (auto *out : this->outputs) {
+		QRect logical(out->x, out->y, out->width, out->height);
+		QRect wanted = logical.intersected(region);
+		if (logical.isEmpty()) {
+			// no logical size from xdg-output; all we can do is take the whole thing
+			wanted = QRect(out->x, out->y, 0, 0);
+		} else if (wanted.isEmpty()) {
+			continue;
+		}
+
 		out->grab = new OutputGrab();
-		out->grab->frame = zwlr_screencopy_manager_v1_capture_output(this->copyMan, false, out->output);
+		out->grab->withDamage = withDamage;
+		out->grab->origin = wanted.topLeft();
+		out->grab->logicalSize = wanted.size();
+		if (wanted == logical || logical.isEmpty()) {
+			out->grab->frame = zwlr_screencopy_manager_v1_capture_output(this->copyMan, false, out->output);
+		} else {
+			out->grab->frame = zwlr_screencopy_manager_v1_capture_output_region(this->copyMan, false, out->output,
+				wanted.x() - out->x, wanted.y() - out->y, wanted.width(), wanted.height());
+		}
 		zwlr_screencopy_frame_v1_add_listener(out->grab->frame, &listener, out);
+		this->outstanding++;
+	}
+	int requested = this->outstanding;
+	qint64 start = Trace::now();
+	bool done = this->dispatchUntilDone(deadline);
+	if (Trace::enabled()) {
+		Trace::complete("screencopy", start, Trace::now(), QString("%1 outputs").arg(requested));
+	}
+	if (!done && !withDamage) {
+		qWarning() << this->outstanding << "outputs did not finish capturing in time";
 	}
-	for (; this->outstanding && wl_display_dispatch_queue(this->dpy, this->q) != -1;);
-
-	QImage out(geom.size(), QImage::Format_ARGB32_Premultiplied);
-	QPainter p(&out);
 
+	QList<WLROutput *> ready;
 	for (auto *output : this->outputs) {
 		auto grab = output->grab;
 		if (!grab) {
-			qDebug() << "failed to grab display" << output->x << output->y;
+			// outside the region, or hotplugged while we were waiting
 			continue;
 		}
-		output->grab = nullptr;
-		auto img = grab->asQImage();
-		p.resetTransform();
-		p.translate(output->x, output->y);
-		switch (output->transform & 3) {
-			// not handling flipped mode correctly
-			case WL_OUTPUT_TRANSFORM_NORMAL:
-				break;
-			case WL_OUTPUT_TRANSFORM_90:
-				p.translate(grab->height / 2.0, grab->width / 2.0);
-				p.rotate(90);
-				p.translate(grab->width / -2.0, grab->height / -2.0);
-				break;
-			case WL_OUTPUT_TRANSFORM_180:
-				p.translate(grab->width / 2.0, grab->height / 2.0);
-				p.rotate(180);
-				p.translate(grab->width / -2.0, grab->height / -2.0);
-				break;
-			case WL_OUTPUT_TRANSFORM_270:
-				p.translate(grab->height / 2.0, grab->width / 2.0);
-				p.rotate(270);
-				p.translate(grab->width / -2.0, grab->height / -2.0);
-				break;
+		// drop the frame now so a late compositor doesn't write into a buffer we're reading
+		zwlr_screencopy_frame_v1_destroy(grab->frame);
+		grab->frame = nullptr;
+		if (!grab->ready) {
+			if (!withDamage) {
+				qDebug() << "failed to grab display" << output->x << output->y;
+			}
+			output->grab = nullptr;
+			delete grab;
+			continue;
+		}
+		if (!grab->logicalSize.isEmpty()) {
+			int bufferWidth = (output->transform & 1) ? grab->buffer->height : grab->buffer->width;
+			output->lastScale = qreal(bufferWidth) / grab->logicalSize.width();
+		}
+		output->lastOrigin = grab->origin;
+		ready.push_back(output);
+	}
+	return ready;
+}
+
+// Compositing has its own workers, so an interactive capture never waits behind encodes queued on
+// the global pool
+static QThreadPool *compositePool() {
+	static QThreadPool *pool = [] {
+		auto *p = new QThreadPool();
+		p->setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+		return p;
+	}();
+	return pool;
+}
+
+// Converts and blits the damaged parts of each output into bits, one worker per output, with the
+// calling thread taking the last one. Returns the area that was written, relative to origin.
+static QRegion composite(uchar *bits, qsizetype stride, QRect bounds, QPoint origin, const QList<WLROutput *> &outputs, const QList<QRegion> &damage) {
+	TraceSpan span("composite");
+	QRegion written;
+	QSemaphore done;
+	for (qsizetype i = 0; i < outputs.size(); i++) {
+		WLROutput *output = outputs[i];
+		OutputBuffer *buffer = output->grab->buffer.get();
+		QPoint offset = output->grab->origin - origin;
+		int32_t w = buffer->width;
+		int32_t h = buffer->height;
+		int transform = output->transform;
+
+		QList<PixelRect> rects;
+		for (const QRect &r : damage[i]) {
+			PixelRect dst = transformRect(PixelRect{r.x(), r.y(), r.width(), r.height()}, w, h, transform);
+			QRect visible = QRect(dst.x + offset.x(), dst.y + offset.y(), dst.width, dst.height).intersected(bounds);
+			if (!visible.isEmpty()) {
+				written += visible;
+				rects.push_back(PixelRect{r.x(), r.y(), r.width(), r.height()});
+			}
+		}
+
+		auto job = [=, &done]() {
+			auto *outputOrigin = reinterpret_cast<uint32_t *>(bits + offset.y() * stride) + offset.x();
+			for (const PixelRect &rect : rects) {
+				QImage img = buffer->convert(rect);
+				if (img.isNull()) {
+					break;
+				}
+
+				// clip in output space, then map back so we never write outside bounds
+				PixelRect dst = transformRect(rect, w, h, transform);
+				QRect visible = QRect(dst.x + offset.x(), dst.y + offset.y(), dst.width, dst.height).intersected(bounds);
+				PixelRect src = untransformRect(
+					PixelRect{visible.x() - offset.x(), visible.y() - offset.y(), visible.width(), visible.height()},
+					w, h, transform);
+				blitTransformed(outputOrigin, stride,
+					reinterpret_cast<const uint32_t *>(img.constBits()), img.bytesPerLine(),
+					w, h, transform, src);
+			}
+			done.release();
+		};
+		if (i == outputs.size() - 1) {
+			job();
+		} else {
+			compositePool()->start(job);
+		}
+	}
+
+	done.acquire(outputs.size());
+	return written;
+}
+
+QImage WLRScreengrabber::grab(QRect geom) {
+	auto ready = this->captureOutputs(geom, false, QDeadlineTimer(CAPTURE_DEADLINE_MS));
+
+	if (ready.size() == 1) {
+		auto *output = ready.first();
+		auto buffer = output->grab->buffer;
+		QRect rect(output->grab->origin, QSize(buffer->width, buffer->height));
+		if ((output->transform & 7) == WL_OUTPUT_TRANSFORM_NORMAL && rect == geom) {
+			delete output->grab;
+			output->grab = nullptr;
+			QImage img = buffer->convert(buffer->bounds());
+			if (!img.isNull() && img.constBits() == buffer->shm) {
+				// hand the mapping to the image instead of copying it out; the buffer stays out of
+				// the pool until the image is gone
+				return QImage(img.constBits(), img.width(), img.height(), img.bytesPerLine(), img.format(),
+					&releaseBuffer, new std::shared_ptr<OutputBuffer>(buffer));
+			}
+			return img;
+		}
+	}
+
+	QImage out(geom.size(), QImage::Format_ARGB32_Premultiplied);
+	uchar *bits = out.bits();
+	qsizetype stride = out.bytesPerLine();
+
+	QList<QRegion> damage;
+	for (auto *output : ready) {
+		const auto &b = output->grab->buffer;
+		damage.push_back(QRect(0, 0, b->width, b->height));
+	}
+
+	QRegion uncovered = QRegion(out.rect()) - composite(bits, stride, out.rect(), geom.topLeft(), ready, damage);
+	for (const QRect &gap : uncovered) {
+		for (int y = gap.top(); y <= gap.bottom(); y++) {
+			memset(bits + y * stride + gap.x() * 4, 0, gap.width() * 4);
 		}
-		p.drawImage(0, 0, img);
-		delete grab;
+	}
+
+	for (auto *output : ready) {
+		delete output->grab;
+		output->grab = nullptr;
 	}
 
 	return out;
 }
+
+QList<ScreenTile> WLRScreengrabber::grabTiles(QRect geom) {
+	auto ready = this->captureOutputs(geom, false, QDeadlineTimer(CAPTURE_DEADLINE_MS));
+
+	QList<ScreenTile> tiles;
+	for (auto *output : ready) {
+		auto buffer = output->grab->buffer;
+		QSize size = (output->transform & 1) ? QSize(buffer->height, buffer->width) : QSize(buffer->width, buffer->height);
+		QRect full(output->grab->origin, size);
+		QRect rect = full.intersected(geom);
+		if (rect.isEmpty()) {
+			continue;
+		}
+
+		if ((output->transform & 7) == WL_OUTPUT_TRANSFORM_NORMAL && rect == full) {
+			QImage img = buffer->convert(buffer->bounds());
+			if (!img.isNull() && img.constBits() == buffer->shm) {
+				img = QImage(img.constBits(), img.width(), img.height(), img.bytesPerLine(), img.format(),
+					&releaseBuffer, new std::shared_ptr<OutputBuffer>(buffer));
+			}
+			tiles.push_back(ScreenTile{rect, img});
+			continue;
+		}
+
+		QImage img(rect.size(), QImage::Format_ARGB32_Premultiplied);
+		img.fill(Qt::transparent);
+		composite(img.bits(), img.bytesPerLine(), img.rect(), rect.topLeft(), {output}, {QRect(0, 0, buffer->width, buffer->height)});
+		tiles.push_back(ScreenTile{rect, img});
+	}
+
+	for (auto *output : ready) {
+		delete output->grab;
+		output->grab = nullptr;
+	}
+
+	return tiles;
+}
+
+QImage WLRScreengrabber::grabIncremental(QRect geom, QRegion *damage, int timeoutMs) {
+	if (this->copyManVersion < 2) {
+		*damage = QRect(QPoint(0, 0), geom.size());
+		return this->grab(geom);
+	}
+
+	bool reset = this->frame.isNull() || this->frameGeometry != geom;
+	if (reset) {
+		this->frame = QImage(geom.size(), QImage::Format_ARGB32_Premultiplied);
+		this->frame.fill(Qt::transparent);
+		this->frameGeometry = geom;
+	}
+
+	// if nothing changes the compositor holds the frame back, so the deadline is the normal way out
+	auto ready = this->captureOutputs(geom, true, QDeadlineTimer(timeoutMs));
+
+	QList<QRegion> outputDamage;
+	for (auto *output : ready) {
+		auto *grab = output->grab;
+		QPoint pos = grab->origin;
+		QRect full(0, 0, grab->buffer->width, grab->buffer->height);
+		bool stale = reset
+			|| output->frameBuffer.lock() != grab->buffer
+			|| output->framePos != pos
+			|| output->frameTransform != output->transform;
+		outputDamage.push_back(stale ? QRegion(full) : grab->damage.intersected(full));
+
+		output->frameBuffer = grab->buffer;
+		output->framePos = pos;
+		output->frameTransform = output->transform;
+	}
+
+	// bits() detaches, so a caller still holding the last frame keeps its copy
+	QRegion written = composite(this->frame.bits(), this->frame.bytesPerLine(), this->frame.rect(), geom.topLeft(), ready, outputDamage);
+	*damage = reset ? QRegion(this->frame.rect()) : written;
+
+	for (auto *output : ready) {
+		delete output->grab;
+		output->grab = nullptr;
+	}
+
+	return this->frame;
+}
+
+QRect WLRScreengrabber::mapFromLogical(QRect logical) const {
+	for (const auto *output : this->outputs) {
+		if (!QRect(output->x, output->y, output->width, output->height).contains(logical.center())) {
+			continue;
+		}
+		QPointF origin = output->lastOrigin;
+		qreal scale = output->lastScale;
+		return QRectF(origin + (logical.topLeft() - origin) * scale, QSizeF(logical.size()) * scale).toRect();
+	}
+	return logical;
+}
+
 WLRScreengrabber *WLRScreengrabber::create(wl_display *dpy) {
 	auto *g = new WLRScreengrabber(dpy);
 	if (!g->init()) {
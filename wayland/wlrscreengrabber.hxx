@@ -8,10 +8,14 @@
 
 #include <wayland-client.h>
 
+#include <QDeadlineTimer>
 #include <QGuiApplication>
+#include <QImage>
 #include <QObject>
 #include <QRect>
+#include <QRegion>
 
+#include "platform.hxx"
 #include "wayland-wlr-screencopy-unstable-v1-client-protocol.h"
 #include "wayland-xdg-output-unstable-v1-client-protocol.h"
 
@@ -24,6 +28,7 @@ class WLRScreengrabber {
 	wl_registry *reg = nullptr;
 	wl_shm *shm = nullptr;
 	zwlr_screencopy_manager_v1 *copyMan = nullptr;
+	uint32_t copyManVersion = 0;
 	zxdg_output_manager_v1 *xdgOutputMan = nullptr;
 	QList<WLROutput *> outputs;
 	int outstanding = 0;
@@ -34,7 +39,26 @@ class WLRScreengrabber {
 	~WLRScreengrabber();
 
 	bool init();
+	// Captures exactly geom; outputs outside it aren't captured, and ones partly inside it only
+	// have the overlapping region copied
 	QImage grab(QRect geom);
+	// Like grab, but each output is returned as its own tile rather than composited into one image
+	QList<ScreenTile> grabTiles(QRect geom);
+	// Keeps a frame of geom between calls and only converts the parts of each output the compositor
+	// reports as changed. damage receives the updated area in frame coordinates. If nothing changes
+	// within timeoutMs the previous frame is returned with no damage.
+	QImage grabIncremental(QRect geom, QRegion *damage, int timeoutMs);
+	// Outputs are composited at their logical position but keep their buffer's scale, so this maps a
+	// rect in the compositor's layout to where the last capture put it
+	QRect mapFromLogical(QRect logical) const;
+
+ private:
+	QImage frame;
+	QRect frameGeometry;
+
+	// starts a frame on every output intersecting region and returns the ones that finished
+	QList<WLROutput *> captureOutputs(QRect region, bool withDamage, QDeadlineTimer deadline);
+	bool dispatchUntilDone(QDeadlineTimer deadline);
 };
 
 #endif
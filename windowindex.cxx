@@ -0,0 +1,85 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "windowindex.hxx"
+
+// cells are square and at least this big, so a few hundred windows don't each land in
+// thousands of cells
+static const int MIN_CELL_SIZE = 64;
+// and there are about this many along the longest side of the desktop
+static const int CELLS_PER_SIDE = 32;
+
+WindowIndex::WindowIndex()
+	: cellSize(MIN_CELL_SIZE), columns(0), rows(0) {
+}
+
+void WindowIndex::rebuild(QList<OpenWindow> windows, QRect bounds) {
+	this->windows = std::move(windows);
+	this->bounds = bounds;
+	this->cellSize = qMax(MIN_CELL_SIZE, (qMax(bounds.width(), bounds.height()) + CELLS_PER_SIDE - 1) / CELLS_PER_SIDE);
+	this->columns = bounds.isEmpty() ? 0 : (bounds.width() + this->cellSize - 1) / this->cellSize;
+	this->rows = bounds.isEmpty() ? 0 : (bounds.height() + this->cellSize - 1) / this->cellSize;
+
+	// count the windows in each cell, turn the counts into offsets, then fill the cells in
+	// window order so each one stays topmost first
+	int cells = this->columns * this->rows;
+	this->cellStart.fill(0, cells + 1);
+
+	auto cellRange = [this](const QRect &r, int *x0, int *y0, int *x1, int *y1) {
+		QRect clipped = r.intersected(this->bounds).translated(-this->bounds.topLeft());
+		if (clipped.isEmpty()) {
+			return false;
+		}
+		*x0 = clipped.left() / this->cellSize;
+		*y0 = clipped.top() / this->cellSize;
+		*x1 = clipped.right() / this->cellSize;
+		*y1 = clipped.bottom() / this->cellSize;
+		return true;
+	};
+
+	int x0, y0, x1, y1;
+	for (const OpenWindow &w : std::as_const(this->windows)) {
+		if (cellRange(w.geometry, &x0, &y0, &x1, &y1)) {
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					this->cellStart[y * this->columns + x + 1]++;
+				}
+			}
+		}
+	}
+	for (int i = 0; i < cells; i++) {
+		this->cellStart[i + 1] += this->cellStart[i];
+	}
+
+	this->entries.resize(this->cellStart[cells]);
+	QList<int> fill(this->cellStart.begin(), this->cellStart.end() - 1);
+	for (int i = 0; i < this->windows.size(); i++) {
+		if (cellRange(this->windows[i].geometry, &x0, &y0, &x1, &y1)) {
+			for (int y = y0; y <= y1; y++) {
+				for (int x = x0; x <= x1; x++) {
+					this->entries[fill[y * this->columns + x]++] = i;
+				}
+			}
+		}
+	}
+}
+
+int WindowIndex::find(QPoint pt) const {
+	if (!this->bounds.contains(pt)) {
+		return -1;
+	}
+
+	QPoint local = pt - this->bounds.topLeft();
+	int cell = (local.y() / this->cellSize) * this->columns + local.x() / this->cellSize;
+	for (int i = this->cellStart[cell]; i < this->cellStart[cell + 1]; i++) {
+		int window = this->entries[i];
+		if (this->windows[window].geometry.contains(pt)) {
+			return window;
+		}
+	}
+	return -1;
+}
+
+const OpenWindow &WindowIndex::at(int index) const {
+	return this->windows[index];
+}
@@ -0,0 +1,35 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef WINDOWINDEX_HXX
+#define WINDOWINDEX_HXX
+
+#include <QList>
+#include <QRect>
+
+#include "platform.hxx"
+
+// Finds the topmost window under a point. Windows are bucketed into a uniform grid over the
+// desktop once per capture, so a lookup only looks at the few windows overlapping one cell and
+// never allocates.
+class WindowIndex {
+	QList<OpenWindow> windows;
+	QRect bounds;
+	int cellSize;
+	int columns;
+	int rows;
+	// the windows in cell i are entries[cellStart[i]] up to entries[cellStart[i + 1]], topmost first
+	QList<int> cellStart;
+	QList<int> entries;
+
+ public:
+	WindowIndex();
+
+	// windows must be topmost first, in the same coordinates as bounds and later lookups
+	void rebuild(QList<OpenWindow> windows, QRect bounds);
+	// the index of the topmost window containing pt, or -1
+	int find(QPoint pt) const;
+	const OpenWindow &at(int index) const;
+};
+
+#endif	// WINDOWINDEX_HXX
@@ -39,6 +39,10 @@ class X11Atoms final : public QObject {
 
 	ATOM_PROP(_NET_WM_STATE)
 	ATOM_PROP(_NET_WM_STATE_HIDDEN)
+
+	ATOM_PROP(_NET_CLIENT_LIST_STACKING)
+	ATOM_PROP(_NET_WM_NAME)
+	ATOM_PROP(UTF8_STRING)
 #undef ATOM_PROP
 };
 Q_DECLARE_METATYPE(xcb_atom_t)
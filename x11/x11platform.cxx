@@ -5,15 +5,25 @@
 #ifdef SHARKS_HAS_X
 #include "x11platform.hxx"
 
-#include <sys/shm.h>
-#include <xcb/shm.h>
 #include <xcb/xfixes.h>
 
-#include <cerrno>
+#include <QScreen>
+#include <algorithm>
+#include <memory>
+
+#include "pixelkernels.hxx"
+#include "trace.hxx"
 
 X11Platform::X11Platform() {
 	this->conn = Platform::nativeObject<QNativeInterface::QX11Application>()->connection();
 	this->atoms = new X11Atoms(this->conn, this);
+	this->shmPool = new X11ShmPool(this->conn);
+	this->windowCacheCreated = false;
+	this->windowCache = nullptr;
+}
+
+X11Platform::~X11Platform() {
+	delete this->shmPool;
 }
 
 bool X11Platform::available() {
@@ -75,7 +85,7 @@ static void walkWindowTree(xcb_connection_t *con, const X11Atoms *atoms, QList<O
 		invalid |= xcbErr(winStateReply.data(), err, "unable to get window State");
 
 		PodPtr<xcb_get_property_reply_t> winNameReply(xcb_get_property_reply(con, winNameCookie, &err));
-		invalid |= xcbErr(winTypeReply.data(), err, "unable to get window name");
+		invalid |= xcbErr(winNameReply.data(), err, "unable to get window name");
 
 		if (invalid) {
 			continue;
@@ -128,7 +138,25 @@ static void walkWindowTree(xcb_connection_t *con, const X11Atoms *atoms, QList<O
 	}
 }
 
+void X11Platform::trackOpenWindows() {
+	if (this->windowCacheCreated) {
+		return;
+	}
+	this->windowCacheCreated = true;
+	this->windowCache = X11WindowCache::create(this->atoms, this);
+	if (this->windowCache) {
+		// read the whole list now, so the first capture only fetches what changed since
+		this->windowCache->available();
+	}
+}
+
 QList<OpenWindow> X11Platform::getOpenWindows() {
+	// a capture without a daemon, like --now, starts it here instead
+	this->trackOpenWindows();
+	if (this->windowCache != nullptr && this->windowCache->available()) {
+		return this->windowCache->windows();
+	}
+
 	QList<OpenWindow> out;
 
 	auto screen = xcb_setup_roots_iterator(xcb_get_setup(this->conn)).data;
@@ -142,29 +170,12 @@ QList<OpenWindow> X11Platform::getOpenWindows() {
 
 	walkWindowTree(this->conn, this->atoms, out, QPoint(0, 0), reply.data());
 
+	// the tree is bottom to top
+	std::reverse(out.begin(), out.end());
 	return out;
 }
 
-class SharedMemory {
- public:
-	explicit SharedMemory(int id) : id(id) {}
-	void free() {
-		if (id >= 0) {
-			shmctl(id, IPC_RMID, nullptr);
-			id = -1;
-		}
-	}
-	~SharedMemory() {
-		this->free();
-	}
-	int id;
-};
-
-static void detachShm(void *data) {
-	shmdt(data);
-}
-
-QPixmap X11Platform::getScreenshot(QRect geometry) {
+QImage X11Platform::getScreenshotImage(QRect geometry) {
 	xcb_generic_error_t *err = nullptr;
 	auto *con = this->conn;
 
@@ -172,48 +183,114 @@ QPixmap X11Platform::getScreenshot(QRect geometry) {
 
 	if (screen->root_depth != 32 && screen->root_depth != 24) {
 		qWarning() << "using slow screen grab because root is" << screen->root_depth << "bpp";
-		return Platform::getScreenshot(geometry);
-	}
-
-	int size = geometry.width() * 4 * geometry.height();
-	SharedMemory shm(shmget(IPC_PRIVATE, size, IPC_CREAT | 0777));
-	if (shm.id == -1) {
-		qWarning() << "unable to create shared memory" << errno;
-		return Platform::getScreenshot(geometry);
+		return Platform::getScreenshotImage(geometry);
 	}
 
-	xcb_shm_seg_t shmseg = xcb_generate_id(con);
-	auto shmAttachCookie = xcb_shm_attach_checked(con, shmseg, shm.id, 0);
-	auto shmgetCookie = xcb_shm_get_image(con, screen->root, geometry.x(), geometry.y(), geometry.width(), geometry.height(), ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, shmseg, 0);
-	xcb_shm_detach(con, shmseg);
-
-	err = xcb_request_check(con, shmAttachCookie);
-	if (err != nullptr) {
-		qWarning() << "unable to attach shmem" << err;
-		free(err);
-		return Platform::getScreenshot(geometry);
+	// size the pool to the whole desktop so it survives between captures of any part of it
+	QRect desktop = QGuiApplication::primaryScreen()->virtualGeometry();
+	size_t size = size_t(geometry.width()) * 4 * geometry.height();
+	size_t capacity = size_t(desktop.width()) * 4 * desktop.height();
+	X11ShmSegment *segment = this->shmPool->acquire(size, capacity);
+	if (segment == nullptr) {
+		return Platform::getScreenshotImage(geometry);
 	}
 
+	qint64 start = Trace::now();
+	auto shmgetCookie = xcb_shm_get_image(con, screen->root, geometry.x(), geometry.y(), geometry.width(), geometry.height(), ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, segment->seg, 0);
 	PodPtr<xcb_shm_get_image_reply_t> shmgetReply(xcb_shm_get_image_reply(con, shmgetCookie, &err));
+	Trace::complete("xcb shm get image", start, Trace::now());
 	if (xcbErr(shmgetReply.data(), err, "unable to get screenshot with xshm")) {
-		return Platform::getScreenshot(geometry);
+		this->shmPool->release(segment);
+		return Platform::getScreenshotImage(geometry);
 	}
 
 	if (shmgetReply->depth != 32 && shmgetReply->depth != 24) {
 		qWarning() << "somehow got a" << shmgetReply->depth << "bpp image";
-		return Platform::getScreenshot(geometry);
+		this->shmPool->release(segment);
+		return Platform::getScreenshotImage(geometry);
 	}
 
-	auto *data = reinterpret_cast<quint32 *>(shmat(shm.id, nullptr, 0));
-	shm.free();
+	auto *data = reinterpret_cast<quint32 *>(segment->data);
 
 	// Qt does not render Images/Pixmaps with RGB32 correctly if they do not have 0xFF alpha set
-	for (size_t i = 0, len = geometry.width() * geometry.height(); i < len; i++) {
-		data[i] |= 0xFF000000;
+	PixelKernels::get().fillAlpha(data, size_t(geometry.width()) * geometry.height());
+
+	return QImage((quint8 *)data, geometry.width(), geometry.height(), QImage::Format_RGB32, &X11ShmPool::releaseImage, segment);
+}
+
+static void releaseSharedSegment(void *segment) {
+	delete reinterpret_cast<std::shared_ptr<X11ShmSegment> *>(segment);
+}
+
+QList<ScreenTile> X11Platform::getScreenshotTiles(QRect geometry) {
+	QList<QRect> parts;
+	size_t size = 0;
+	const auto screens = QGuiApplication::screens();
+	for (auto *screen : screens) {
+		QRect part = screen->geometry().intersected(geometry);
+		if (!part.isEmpty()) {
+			parts.push_back(part);
+			size += size_t(part.width()) * 4 * part.height();
+		}
+	}
+	if (parts.size() < 2) {
+		return Platform::getScreenshotTiles(geometry);
+	}
+
+	auto *con = this->conn;
+	auto screen = xcb_setup_roots_iterator(xcb_get_setup(this->conn)).data;
+	if (screen->root_depth != 32 && screen->root_depth != 24) {
+		return Platform::getScreenshotTiles(geometry);
 	}
 
-	QImage img((quint8 *)data, geometry.width(), geometry.height(), QImage::Format_RGB32, &detachShm, data);
-	return QPixmap::fromImage(img);
+	// every tile goes in one segment, so the pool keeps a single desktop sized one either way
+	QRect desktop = QGuiApplication::primaryScreen()->virtualGeometry();
+	size_t capacity = size_t(desktop.width()) * 4 * desktop.height();
+	X11ShmSegment *segment = this->shmPool->acquire(size, capacity);
+	if (segment == nullptr) {
+		return Platform::getScreenshotTiles(geometry);
+	}
+
+	qint64 start = Trace::now();
+	QList<xcb_shm_get_image_cookie_t> cookies;
+	size_t offset = 0;
+	for (const QRect &part : std::as_const(parts)) {
+		cookies.push_back(xcb_shm_get_image(con, screen->root, part.x(), part.y(), part.width(), part.height(), ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, segment->seg, offset));
+		offset += size_t(part.width()) * 4 * part.height();
+	}
+	bool ok = true;
+	for (auto cookie : cookies) {
+		xcb_generic_error_t *err = nullptr;
+		PodPtr<xcb_shm_get_image_reply_t> reply(xcb_shm_get_image_reply(con, cookie, &err));
+		if (xcbErr(reply.data(), err, "unable to get screenshot with xshm")) {
+			ok = false;
+		} else if (reply->depth != 32 && reply->depth != 24) {
+			qWarning() << "somehow got a" << reply->depth << "bpp image";
+			ok = false;
+		}
+	}
+	if (Trace::enabled()) {
+		Trace::complete("xcb shm get image", start, Trace::now(), QString("%1 tiles").arg(parts.size()));
+	}
+	if (!ok) {
+		this->shmPool->release(segment);
+		return Platform::getScreenshotTiles(geometry);
+	}
+
+	auto *data = reinterpret_cast<quint8 *>(segment->data);
+	PixelKernels::get().fillAlpha(reinterpret_cast<quint32 *>(data), size / 4);
+
+	// the segment goes back to the pool once every tile is gone
+	std::shared_ptr<X11ShmSegment> shared(segment, &X11ShmPool::releaseImage);
+	QList<ScreenTile> tiles;
+	offset = 0;
+	for (const QRect &part : std::as_const(parts)) {
+		QImage img(data + offset, part.width(), part.height(), QImage::Format_RGB32,
+			&releaseSharedSegment, new std::shared_ptr<X11ShmSegment>(shared));
+		tiles.push_back(ScreenTile{part, img});
+		offset += size_t(part.width()) * 4 * part.height();
+	}
+	return tiles;
 }
 
 #endif
\ No newline at end of file
@@ -7,6 +7,8 @@
 #ifdef SHARKS_HAS_X
 #include "platform.hxx"
 #include "x11atoms.hxx"
+#include "x11shmpool.hxx"
+#include "x11windowcache.hxx"
 
 class X11Platform : public Platform {
 	Q_OBJECT
@@ -14,15 +16,22 @@ class X11Platform : public Platform {
 
 	xcb_connection_t *conn;
 	X11Atoms *atoms;
+	X11ShmPool *shmPool;
+	// made by trackOpenWindows, so a headless capture doesn't open it
+	bool windowCacheCreated;
+	X11WindowCache *windowCache;
 
  public:
 	X11Platform();
+	~X11Platform();
 
 	static bool available();
 
 	QImage getCursorImage() override;
+	void trackOpenWindows() override;
 	QList<OpenWindow> getOpenWindows() override;
-	QPixmap getScreenshot(QRect geom) override;
+	QImage getScreenshotImage(QRect geom) override;
+	QList<ScreenTile> getScreenshotTiles(QRect geom) override;
 };
 
 #endif
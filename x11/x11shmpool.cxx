@@ -0,0 +1,133 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+
+#ifdef SHARKS_HAS_X
+#include "x11shmpool.hxx"
+
+#include <sys/shm.h>
+
+#include <QDebug>
+#include <QMutex>
+#include <cerrno>
+
+#include "x11atoms.hxx"
+
+// free segments kept around beyond the one in use, so a capture can start while the last one is still alive
+static const int MAX_FREE_SEGMENTS = 2;
+
+// Guards every pool and the pool pointer in each segment. It outlives the pools, so an image
+// released after its pool was destroyed can still check whether it is the last owner.
+static QMutex poolMutex;
+
+X11ShmPool::X11ShmPool(xcb_connection_t *conn)
+	: conn(conn),
+		segments() {
+}
+
+X11ShmPool::~X11ShmPool() {
+	QMutexLocker lock(&poolMutex);
+	for (auto *segment : std::as_const(this->segments)) {
+		if (segment->busy) {
+			// still owned by an image, which frees it when it is done
+			segment->pool = nullptr;
+		} else {
+			this->destroy(segment);
+		}
+	}
+	this->segments.clear();
+}
+
+X11ShmSegment *X11ShmPool::allocate(size_t size) {
+	// segments outlive the capture and keep its pixels, so nobody else may attach them
+	int id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if (id == -1) {
+		qWarning() << "unable to create shared memory" << errno;
+		return nullptr;
+	}
+
+	void *data = shmat(id, nullptr, 0);
+	if (data == reinterpret_cast<void *>(-1)) {
+		qWarning() << "unable to map shared memory" << errno;
+		shmctl(id, IPC_RMID, nullptr);
+		return nullptr;
+	}
+
+	xcb_shm_seg_t seg = xcb_generate_id(this->conn);
+	xcb_generic_error_t *err = xcb_request_check(this->conn, xcb_shm_attach_checked(this->conn, seg, id, false));
+
+	// both sides are attached now, so the id can go; the segment lives until the last detach
+	shmctl(id, IPC_RMID, nullptr);
+
+	if (err != nullptr) {
+		qWarning() << "unable to attach shmem" << err;
+		free(err);
+		shmdt(data);
+		return nullptr;
+	}
+
+	return new X11ShmSegment{this, this->conn, id, seg, data, size, false};
+}
+
+void X11ShmPool::destroy(X11ShmSegment *segment) {
+	xcb_shm_detach(this->conn, segment->seg);
+	shmdt(segment->data);
+	delete segment;
+}
+
+X11ShmSegment *X11ShmPool::acquire(size_t size, size_t capacity) {
+	capacity = std::max(size, capacity);
+
+	QMutexLocker lock(&poolMutex);
+
+	X11ShmSegment *found = nullptr;
+	int spare = 0;
+	this->segments.removeIf([&](X11ShmSegment *segment) {
+		if (segment->busy) {
+			return false;
+		}
+		if (found == nullptr && segment->size == capacity) {
+			found = segment;
+			return false;
+		}
+		if (segment->size != capacity || ++spare > MAX_FREE_SEGMENTS) {
+			// the desktop changed size, or we built up too many while images were held
+			this->destroy(segment);
+			return true;
+		}
+		return false;
+	});
+
+	if (found == nullptr) {
+		found = this->allocate(capacity);
+		if (found == nullptr) {
+			return nullptr;
+		}
+		this->segments.push_back(found);
+	}
+
+	found->busy = true;
+	return found;
+}
+
+void X11ShmPool::release(X11ShmSegment *segment) {
+	QMutexLocker lock(&poolMutex);
+	segment->busy = false;
+}
+
+void X11ShmPool::releaseImage(void *segment) {
+	auto *seg = reinterpret_cast<X11ShmSegment *>(segment);
+	QMutexLocker lock(&poolMutex);
+	if (seg->pool != nullptr) {
+		seg->busy = false;
+		return;
+	}
+
+	// the pool is gone, so this was the last owner
+	xcb_shm_detach(seg->conn, seg->seg);
+	xcb_flush(seg->conn);
+	shmdt(seg->data);
+	delete seg;
+}
+
+#endif
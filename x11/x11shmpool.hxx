@@ -0,0 +1,54 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef X11SHMPOOL_HXX
+#define X11SHMPOOL_HXX
+
+#ifdef SHARKS_HAS_X
+
+#include <xcb/shm.h>
+#include <xcb/xcb.h>
+
+#include <QList>
+
+class X11ShmPool;
+
+struct X11ShmSegment {
+	// null once the pool is gone, so the last image detaches the segment itself
+	X11ShmPool *pool;
+	xcb_connection_t *conn;
+	int id;
+	xcb_shm_seg_t seg;
+	void *data;
+	size_t size;
+	bool busy;
+};
+
+// Keeps MIT-SHM segments attached on both our side and the server's between captures,
+// so a screenshot only costs the xcb_shm_get_image round trip.
+class X11ShmPool {
+	Q_DISABLE_COPY(X11ShmPool)
+
+	xcb_connection_t *conn;
+	QList<X11ShmSegment *> segments;
+
+	X11ShmSegment *allocate(size_t size);
+	void destroy(X11ShmSegment *segment);
+
+ public:
+	explicit X11ShmPool(xcb_connection_t *conn);
+	~X11ShmPool();
+
+	// Returns a free segment of at least size bytes. New segments are made capacity bytes
+	// large, and free segments of any other capacity are dropped, so the pool follows the
+	// desktop size. Returns nullptr if shm is unusable.
+	X11ShmSegment *acquire(size_t size, size_t capacity);
+	// Hands a segment back to the pool; safe to call from any thread
+	void release(X11ShmSegment *segment);
+
+	// QImageCleanupFunction that releases the X11ShmSegment passed as info
+	static void releaseImage(void *segment);
+};
+
+#endif
+#endif	// X11SHMPOOL_HXX
@@ -0,0 +1,320 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#include "x11windowcache.hxx"
+
+#ifdef SHARKS_HAS_X
+
+#include <QDebug>
+
+#include "trace.hxx"
+
+// the most clients read from _NET_CLIENT_LIST_STACKING, in 32 bit units
+static const uint32_t MAX_CLIENTS = 4096;
+
+X11WindowCache::X11WindowCache(xcb_connection_t *conn, const X11Atoms *atoms, QObject *parent)
+	: QObject(parent),
+		conn(conn),
+		atoms(atoms),
+		stackingDirty(true),
+		allGeometryDirty(false),
+		allPropertiesDirty(false),
+		dirty(true),
+		supported(false) {
+	this->root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+
+	// SubstructureNotify on the root covers frames being moved, mapped and unmapped, and
+	// PropertyChange covers the client list itself
+	uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
+	xcb_change_window_attributes(conn, this->root, XCB_CW_EVENT_MASK, &mask);
+	xcb_flush(conn);
+
+	this->notifier = new QSocketNotifier(xcb_get_file_descriptor(conn), QSocketNotifier::Read, this);
+	connect(this->notifier, &QSocketNotifier::activated, this, &X11WindowCache::readEvents);
+}
+
+X11WindowCache *X11WindowCache::create(const X11Atoms *atoms, QObject *parent) {
+	if (atoms->_NET_CLIENT_LIST_STACKING == XCB_ATOM_NONE) {
+		// the atom is only interned if something made it, so no window manager publishes the list
+		return nullptr;
+	}
+
+	xcb_connection_t *conn = xcb_connect(nullptr, nullptr);
+	if (xcb_connection_has_error(conn)) {
+		qWarning() << "unable to open a connection for the window list";
+		xcb_disconnect(conn);
+		return nullptr;
+	}
+
+	return new X11WindowCache(conn, atoms, parent);
+}
+
+X11WindowCache::~X11WindowCache() {
+	delete this->notifier;
+	xcb_disconnect(this->conn);
+}
+
+void X11WindowCache::readEvents() {
+	while (xcb_generic_event_t *ev = xcb_poll_for_event(this->conn)) {
+		this->handleEvent(ev);
+		free(ev);
+	}
+
+	if (xcb_connection_has_error(this->conn)) {
+		qWarning() << "lost the window list connection";
+		this->notifier->setEnabled(false);
+		this->dirty = false;
+		this->supported = false;
+	}
+}
+
+void X11WindowCache::handleEvent(const xcb_generic_event_t *ev) {
+	switch (ev->response_type & ~0x80) {
+		case XCB_PROPERTY_NOTIFY: {
+			auto *pn = reinterpret_cast<const xcb_property_notify_event_t *>(ev);
+			if (pn->window == this->root) {
+				if (pn->atom != this->atoms->_NET_CLIENT_LIST_STACKING) {
+					return;
+				}
+				this->stackingDirty = true;
+			} else {
+				auto it = this->clients.find(pn->window);
+				if (it == this->clients.end()) {
+					return;
+				}
+				if (pn->atom != this->atoms->_NET_WM_STATE
+					&& pn->atom != this->atoms->_NET_WM_WINDOW_TYPE
+					&& pn->atom != this->atoms->_NET_WM_NAME
+					&& pn->atom != XCB_ATOM_WM_NAME) {
+					return;
+				}
+				it->propertiesDirty = true;
+			}
+			break;
+		}
+		case XCB_CONFIGURE_NOTIFY: {
+			auto *cn = reinterpret_cast<const xcb_configure_notify_event_t *>(ev);
+			auto it = this->clients.find(cn->window);
+			if (it != this->clients.end()) {
+				it->geometryDirty = true;
+			} else if (cn->event == this->root) {
+				this->allGeometryDirty = true;
+			} else {
+				return;
+			}
+			break;
+		}
+		case XCB_MAP_NOTIFY:
+		case XCB_UNMAP_NOTIFY: {
+			// both events start with the same fields
+			auto *mn = reinterpret_cast<const xcb_map_notify_event_t *>(ev);
+			auto it = this->clients.find(mn->window);
+			if (it != this->clients.end()) {
+				it->propertiesDirty = true;
+			} else if (mn->event == this->root) {
+				// a client is only viewable if its frame is mapped too
+				this->allPropertiesDirty = true;
+			} else {
+				return;
+			}
+			break;
+		}
+		case XCB_DESTROY_NOTIFY:
+			this->stackingDirty = true;
+			break;
+		default:
+			return;
+	}
+
+	this->dirty = true;
+}
+
+void X11WindowCache::refreshStacking() {
+	xcb_generic_error_t *err = nullptr;
+	auto cookie = xcb_get_property(this->conn, false, this->root, this->atoms->_NET_CLIENT_LIST_STACKING, XCB_ATOM_WINDOW, 0, MAX_CLIENTS);
+	PodPtr<xcb_get_property_reply_t> reply(xcb_get_property_reply(this->conn, cookie, &err));
+	if (xcbErr(reply.data(), err, "unable to get client list")) {
+		this->supported = false;
+		return;
+	}
+	this->stackingDirty = false;
+	this->supported = reply->type == XCB_ATOM_WINDOW;
+
+	auto *wins = reinterpret_cast<xcb_window_t *>(xcb_get_property_value(reply.data()));
+	int len = xcb_get_property_value_length(reply.data()) / sizeof(xcb_window_t);
+	QList<xcb_window_t> stacking(wins, wins + len);
+
+	QHash<xcb_window_t, Client> clients;
+	clients.reserve(len);
+	for (xcb_window_t win : stacking) {
+		auto it = this->clients.find(win);
+		if (it != this->clients.end()) {
+			clients.insert(win, *it);
+			continue;
+		}
+
+		// new client, so start listening to it too
+		uint32_t mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_PROPERTY_CHANGE;
+		xcb_change_window_attributes(this->conn, win, XCB_CW_EVENT_MASK, &mask);
+		clients.insert(win, Client{{}, {}, false, false, true, true});
+	}
+
+	this->stacking = std::move(stacking);
+	this->clients = std::move(clients);
+}
+
+void X11WindowCache::refreshClients() {
+	struct Pending {
+		xcb_window_t win;
+		xcb_get_geometry_cookie_t geo;
+		xcb_translate_coordinates_cookie_t pos;
+		xcb_get_window_attributes_cookie_t attrib;
+		xcb_get_property_cookie_t type;
+		xcb_get_property_cookie_t state;
+		xcb_get_property_cookie_t netName;
+		xcb_get_property_cookie_t name;
+		bool geometry;
+		bool properties;
+	};
+
+	// send everything before reading anything, so it costs one round trip however many changed
+	QList<Pending> pending;
+	for (auto it = this->clients.begin(); it != this->clients.end(); ++it) {
+		bool geometry = it->geometryDirty || this->allGeometryDirty;
+		bool properties = it->propertiesDirty || this->allPropertiesDirty;
+		if (!geometry && !properties) {
+			continue;
+		}
+		Pending p = {};
+		p.win = it.key();
+		p.geometry = geometry;
+		p.properties = properties;
+		if (p.geometry) {
+			p.geo = xcb_get_geometry(this->conn, p.win);
+			p.pos = xcb_translate_coordinates(this->conn, p.win, this->root, 0, 0);
+		}
+		if (p.properties) {
+			p.attrib = xcb_get_window_attributes(this->conn, p.win);
+			p.type = xcb_get_property(this->conn, false, p.win, this->atoms->_NET_WM_WINDOW_TYPE, XCB_ATOM_ATOM, 0, 32);
+			p.state = xcb_get_property(this->conn, false, p.win, this->atoms->_NET_WM_STATE, XCB_ATOM_ATOM, 0, 32);
+			p.netName = xcb_get_property(this->conn, false, p.win, this->atoms->_NET_WM_NAME, this->atoms->UTF8_STRING, 0, 64);
+			p.name = xcb_get_property(this->conn, false, p.win, XCB_ATOM_WM_NAME, XCB_ATOM_ANY, 0, 64);
+		}
+		pending.push_back(p);
+	}
+	this->allGeometryDirty = false;
+	this->allPropertiesDirty = false;
+
+	for (const Pending &p : pending) {
+		Client &c = this->clients[p.win];
+		// errors here are almost always windows that were destroyed after the list was read; the
+		// list will change again shortly, so just leave them out until then
+		bool gone = false;
+
+		if (p.geometry) {
+			xcb_generic_error_t *err = nullptr;
+			PodPtr<xcb_get_geometry_reply_t> geo(xcb_get_geometry_reply(this->conn, p.geo, &err));
+			free(err);
+			PodPtr<xcb_translate_coordinates_reply_t> pos(xcb_translate_coordinates_reply(this->conn, p.pos, &err));
+			free(err);
+			if (geo && pos) {
+				c.geometry = QRect(pos->dst_x, pos->dst_y, geo->width, geo->height);
+			} else {
+				gone = true;
+			}
+		}
+
+		if (p.properties) {
+			xcb_generic_error_t *err = nullptr;
+			PodPtr<xcb_get_window_attributes_reply_t> attrib(xcb_get_window_attributes_reply(this->conn, p.attrib, &err));
+			free(err);
+			PodPtr<xcb_get_property_reply_t> type(xcb_get_property_reply(this->conn, p.type, &err));
+			free(err);
+			PodPtr<xcb_get_property_reply_t> state(xcb_get_property_reply(this->conn, p.state, &err));
+			free(err);
+			PodPtr<xcb_get_property_reply_t> netName(xcb_get_property_reply(this->conn, p.netName, &err));
+			free(err);
+			PodPtr<xcb_get_property_reply_t> name(xcb_get_property_reply(this->conn, p.name, &err));
+			free(err);
+
+			if (attrib && type && state && netName && name) {
+				// clients without a type are normal windows, per the EWMH
+				auto *types = reinterpret_cast<xcb_atom_t *>(xcb_get_property_value(type.data()));
+				int typesLen = xcb_get_property_value_length(type.data()) / sizeof(xcb_atom_t);
+				c.selectable = typesLen == 0;
+				for (int i = 0; i < typesLen; i++) {
+					c.selectable |= types[i] == this->atoms->_NET_WM_WINDOW_TYPE_DIALOG
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_DOCK
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_MENU
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_NORMAL
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_NOTIFICATION
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_SPLASH
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_TOOLBAR
+						|| types[i] == this->atoms->_NET_WM_WINDOW_TYPE_UTILITY;
+				}
+
+				c.visible = attrib->map_state == XCB_MAP_STATE_VIEWABLE;
+				auto *states = reinterpret_cast<xcb_atom_t *>(xcb_get_property_value(state.data()));
+				int statesLen = xcb_get_property_value_length(state.data()) / sizeof(xcb_atom_t);
+				for (int i = 0; i < statesLen; i++) {
+					c.visible &= states[i] != this->atoms->_NET_WM_STATE_HIDDEN;
+				}
+
+				if (xcb_get_property_value_length(netName.data()) > 0) {
+					c.name = QString::fromUtf8((const char *)xcb_get_property_value(netName.data()), xcb_get_property_value_length(netName.data()));
+				} else {
+					c.name = QString::fromLocal8Bit((const char *)xcb_get_property_value(name.data()), xcb_get_property_value_length(name.data()));
+				}
+			} else {
+				gone = true;
+			}
+		}
+
+		c.geometryDirty = false;
+		c.propertiesDirty = false;
+		if (gone) {
+			c.visible = false;
+		}
+	}
+}
+
+void X11WindowCache::refresh() {
+	TraceSpan span("window cache refresh");
+	this->dirty = false;
+
+	if (this->stackingDirty) {
+		this->refreshStacking();
+	}
+	this->refreshClients();
+
+	this->snapshot.clear();
+	for (auto it = this->stacking.crbegin(); it != this->stacking.crend(); ++it) {
+		const Client &c = this->clients[*it];
+		if (c.selectable && c.visible && !c.geometry.isEmpty()) {
+			this->snapshot.push_back(OpenWindow{c.geometry, c.name});
+		}
+	}
+
+	// waiting on the replies can read events into xcb's queue without waking the notifier
+	this->readEvents();
+}
+
+bool X11WindowCache::available() {
+	// pick up anything that arrived since the notifier last fired
+	if (this->notifier->isEnabled()) {
+		this->readEvents();
+	}
+	if (this->dirty) {
+		this->refresh();
+	}
+	return this->supported;
+}
+
+QList<OpenWindow> X11WindowCache::windows() {
+	if (this->dirty) {
+		this->refresh();
+	}
+	return this->snapshot;
+}
+
+#endif
@@ -0,0 +1,72 @@
+// This Source Code Form is subject to the terms of the Mozilla Public
+// License, v. 2.0. If a copy of the MPL was not distributed with this
+// file, You can obtain one at https://mozilla.org/MPL/2.0/.
+#ifndef X11WINDOWCACHE_HXX
+#define X11WINDOWCACHE_HXX
+
+#ifdef SHARKS_HAS_X
+
+#include <xcb/xcb.h>
+
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSocketNotifier>
+
+#include "platform.hxx"
+#include "x11atoms.hxx"
+
+// Caches the window manager's client list from _NET_CLIENT_LIST_STACKING. Events only mark what
+// changed, and the changed parts are fetched in one batch when the list is asked for, so a capture
+// costs one round trip rather than a walk of the tree, and moving windows around costs nothing.
+// It has its own connection so the event masks it selects don't replace Qt's.
+class X11WindowCache : public QObject {
+	Q_OBJECT
+	Q_DISABLE_COPY(X11WindowCache)
+
+	struct Client {
+		QRect geometry;
+		QString name;
+		bool selectable;
+		bool visible;
+		bool geometryDirty;
+		bool propertiesDirty;
+	};
+
+	xcb_connection_t *conn;
+	xcb_window_t root;
+	const X11Atoms *atoms;
+	QSocketNotifier *notifier;
+
+	// bottom to top, like the property
+	QList<xcb_window_t> stacking;
+	QHash<xcb_window_t, Client> clients;
+	bool stackingDirty;
+	// a frame moved or was mapped, and we don't track which client is inside it
+	bool allGeometryDirty;
+	bool allPropertiesDirty;
+	// anything changed since the last refresh
+	bool dirty;
+	bool supported;
+	QList<OpenWindow> snapshot;
+
+	X11WindowCache(xcb_connection_t *conn, const X11Atoms *atoms, QObject *parent);
+	void readEvents();
+	void handleEvent(const xcb_generic_event_t *ev);
+	void refreshStacking();
+	void refreshClients();
+	void refresh();
+
+ public:
+	// returns nullptr if a second connection to the display can't be opened
+	static X11WindowCache *create(const X11Atoms *atoms, QObject *parent);
+	~X11WindowCache();
+
+	// false until the list has been read, or if the window manager doesn't publish one
+	bool available();
+	// selectable windows, topmost first
+	QList<OpenWindow> windows();
+};
+
+#endif
+#endif	// X11WINDOWCACHE_HXX